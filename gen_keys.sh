@@ -0,0 +1,159 @@
+#!/bin/sh
+# Generates keys.h from the kernel's input-event-codes.h: a perfect hash
+# table to convert key names to key codes and a key code indexed table to
+# convert key codes to names.
+#
+# Usage: gen_keys.sh [/usr/include/linux/input-event-codes.h] > keys.h
+#
+# Key names are the kernel ones without the "KEY_" prefix, buttons keep the
+# "BTN_" prefix. Aliases defined by the kernel are kept and the ones below
+# are added, the name of a key code is its first non alias definition.
+#
+# The name hash, mirrored by key_name_hash() in hkd.c, starts from h = seed
+# and for every character c of the name computes:
+#	h = (h * (31 + 2 * seed) + c - 31) % 4294967291
+# where c is the ASCII code of the character. awk has no ord(), so c - 31 is
+# computed as the index of the character in the printable ASCII characters.
+# Names are assigned to buckets with seed zero, then every bucket is given the
+# first seed that places all of its names in free slots of the table (hash and
+# displace).
+
+INPUT_H=${1:-/usr/include/linux/input-event-codes.h}
+
+awk -v input_h="$INPUT_H" '
+function hex(s,    v, i) {
+	s = tolower(s)
+	sub(/^0x/, "", s)
+	v = 0
+	for (i = 1; i <= length(s); i++)
+		v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+	return v
+}
+
+function name_hash(name, seed,    h, m, i) {
+	h = seed
+	m = 31 + 2 * seed
+	for (i = 1; i <= length(name); i++)
+		h = (h * m + index(chars, substr(name, i, 1))) % 4294967291
+	return h
+}
+
+function add(name, macro, value) {
+	if (name in seen)
+		return
+	seen[name] = 1
+	names[n] = name
+	macros[n] = macro
+	values[n] = value
+	n++
+}
+
+BEGIN {
+	for (i = 32; i < 127; i++)
+		chars = chars sprintf("%c", i)
+	n = 0
+}
+
+$1 == "#define" && $2 ~ /^(KEY|BTN)_/ {
+	macro = $2
+	if (macro == "KEY_MAX" || macro == "KEY_CNT" || \
+	    macro == "KEY_MIN_INTERESTING" || macro == "KEY_RESERVED")
+		next
+	if ($3 ~ /^0x[0-9a-fA-F]+$/)
+		value = hex($3)
+	else if ($3 ~ /^[0-9]+$/)
+		value = $3 + 0
+	else if ($3 in code)
+		value = code[$3]
+	else
+		next
+	code[macro] = value
+	name = macro
+	sub(/^KEY_/, "", name)
+	add(name, macro, value)
+	# Only definitions by value name a key code
+	if ($3 ~ /^[0-9]/ && !(value in code_name))
+		code_name[value] = name
+}
+
+END {
+	# hkd aliases
+	add("CTRL", "KEY_LEFTCTRL", code["KEY_LEFTCTRL"])
+	add("META", "KEY_LEFTMETA", code["KEY_LEFTMETA"])
+	add("ALT", "KEY_LEFTALT", code["KEY_LEFTALT"])
+	add("SHIFT", "KEY_LEFTSHIFT", code["KEY_LEFTSHIFT"])
+	add("PRINTSCR", "KEY_SYSRQ", code["KEY_SYSRQ"])
+	add("MIC_MUTE", "KEY_F20", code["KEY_F20"])
+
+	buckets = int(n / 2) + 1
+	size = 2 * n + 1
+	max = 0
+	for (i = 0; i < n; i++) {
+		b = name_hash(names[i], 0) % buckets
+		bucket[b, bsize[b]++] = i
+		if (bsize[b] > max)
+			max = bsize[b]
+	}
+
+	# Place the biggest buckets first
+	for (s = max; s > 0; s--) {
+		for (b = 0; b < buckets; b++) {
+			if (bsize[b] != s)
+				continue
+			for (seed = 1; ; seed++) {
+				ok = 1
+				for (j = 0; j < s && ok; j++) {
+					t = name_hash(names[bucket[b, j]], seed) % size
+					if (t in slot)
+						ok = 0
+					for (k = 0; k < j && ok; k++)
+						ok = t != try[k]
+					try[j] = t
+				}
+				if (ok)
+					break
+			}
+			seeds[b] = seed
+			for (j = 0; j < s; j++)
+				slot[try[j]] = bucket[b, j]
+		}
+	}
+
+	printf "/* Generated by gen_keys.sh from %s, do not edit */\n\n", input_h
+	print "#ifndef _H_KEYS"
+	print "#define _H_KEYS"
+	print ""
+	print "#include <linux/input.h>"
+	print ""
+	printf "#define KEY_NAME_BUCKETS %d\n", buckets
+	printf "#define KEY_NAME_SLOTS %d\n", size
+	print ""
+	print "struct key_name {"
+	print "\tconst char *const name;"
+	print "\tconst unsigned short value;"
+	print "};"
+	print ""
+	print "/* Key names (aliases included) in their perfect hash slot */"
+	print "const struct key_name key_conversion_table[KEY_NAME_SLOTS] = {"
+	for (t = 0; t < size; t++)
+		if (t in slot)
+			printf "\t[%d] = {\"%s\", %s},\n", t, names[slot[t]], macros[slot[t]]
+	print "};"
+	print ""
+	print "/* Hash seed of every bucket */"
+	print "const unsigned short key_name_seeds[KEY_NAME_BUCKETS] = {"
+	for (b = 0; b < buckets; b++)
+		printf "%s%d,%s", (b % 16 ? " " : "\t"), (b in seeds ? seeds[b] : 0), \
+			(b % 16 == 15 || b == buckets - 1 ? "\n" : "")
+	print "};"
+	print ""
+	print "/* Name of every key code, NULL for unknown codes */"
+	print "const char *const key_code_names[KEY_CNT] = {"
+	for (i = 0; i < n; i++)
+		if (code_name[values[i]] == names[i])
+			printf "\t[%s] = \"%s\",\n", macros[i], names[i]
+	print "};"
+	print ""
+	print "#endif"
+}
+' "$INPUT_H"
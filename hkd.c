@@ -35,16 +35,48 @@
 #include <sys/wait.h>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <wordexp.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <limits.h>
 #include "keys.h"
 
 /* Value defines */
 #define FILE_NAME_MAX_LENGTH 255
 #define KEY_BUFFER_SIZE 16
-#define BLOCK_SIZE 512
+#define MAX_EVENTS 32
+#define EV_READ_SIZE 64
+#define SETTLE_DELAY_MS 100
+#define RELOAD_DELAY_MS 200
+#define RETRY_MAX 6
+#define REPLAY_POLL_MS 10
+#define RECORD_BUF_SIZE 65536
+#define RECORD_MAX 64 /* Longest encoded event record */
+#define RECORD_MAGIC "HKDR"
+#define RECORD_VERSION 1
+#define TRIE_ROOT 0
+#define TRIE_DEAD UINT_MAX
+#define HOTKEY_NONE UINT_MAX
+#define EXEC_MSG_MAX 65536
+#define HKDC_MAGIC 0x43444b48 /* "HKDC" */
+#define HKDC_VERSION 2
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS 256 /* Up to about 2^33 us */
+
+/* Not exposed by older C libraries */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 /* ANSI colors escape codes */
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -60,6 +92,8 @@
 #define green(str) (ANSI_COLOR_GREEN str ANSI_COLOR_RESET)
 #define red(str) (ANSI_COLOR_RED str ANSI_COLOR_RESET)
 #define test_bit(yalv, abs_b) ((((char *)abs_b)[yalv/8] & (1<<yalv%8)) > 0)
+#define set_bit(yalv, abs_b) (((char *)abs_b)[yalv/8] |= (1<<yalv%8))
+#define clear_bit(yalv, abs_b) (((char *)abs_b)[yalv/8] &= ~(1<<yalv%8))
 #define array_size(val) (val ? sizeof(val)/sizeof(val[0]) : 0)
 #define array_size_const(val) ((int)(sizeof(val)/sizeof(val[0])))
 
@@ -67,6 +101,18 @@
 #define EVENT_BUF_LEN (1024*(EVENT_SIZE+16))
 #define EVDEV_ROOT_DIR "/dev/input/"
 #define LOCK_FILE "/tmp/hkd.lock"
+#define STATS_FILE "hkd.stats"
+#define CONTROL_SOCKET "hkd.sock"
+#define CONTROL_LINE_MAX 4096
+
+/* Always delivered by the kernel so that pressing a bound key together with
+ * an unbound modifier is not mistaken for the bare hotkey */
+const unsigned short modifier_keys[] = {
+	KEY_LEFTCTRL, KEY_RIGHTCTRL,
+	KEY_LEFTSHIFT, KEY_RIGHTSHIFT,
+	KEY_LEFTALT, KEY_RIGHTALT,
+	KEY_LEFTMETA, KEY_RIGHTMETA,
+};
 
 const char *config_paths[] = {
 	"$XDG_CONFIG_HOME/hkd/config",
@@ -79,59 +125,478 @@ struct key_buffer {
 	unsigned int size;
 };
 
-/* Hotkey list: linked list that holds all valid hoteys parsed from the
- * config file and the corresponding command */
-struct hotkey_list_e {
-	struct key_buffer kb;
-	char *command;
-	int fuzzy;
-	struct hotkey_list_e *next;
+/* Pressed keys state: a bitmap covering every key code for constant time
+ * lookups, plus a doubly linked list threaded through the key codes that
+ * keeps the press order, KEY_CNT marks the ends of the list */
+struct key_state {
+	unsigned char bits[KEY_CNT / 8 + 1];
+	unsigned short prev[KEY_CNT];
+	unsigned short next[KEY_CNT];
+	unsigned short head, tail;
+	unsigned int size; /* Number of pressed keys */
+	unsigned long long hash; /* Chord hash of the pressed keys */
+	unsigned int trie_node; /* Trie node reached by the press order */
+};
+
+#define key_state_foreach(k, ks) \
+	for (unsigned int k = (ks)->head; k != KEY_CNT; k = (ks)->next[k])
+
+/* Hotkey flags */
+#define HOTKEY_FUZZY 1
+#define HOTKEY_LATE 2 /* command expanded on every trigger */
+#define HOTKEY_REMOVED 4 /* removed through the control socket */
+
+/* Log-linear histogram of latencies in us, HDR style: values below
+ * 2 * HIST_SUB have a bucket each, then every power of two range is split in
+ * HIST_SUB linear buckets, so the error is bounded by 1 / HIST_SUB */
+struct histogram {
+	unsigned long long count;
+	unsigned long long max;
+	unsigned int buckets[HIST_BUCKETS];
+};
+
+/* Latency of each stage of a hotkey run, measured from the kernel timestamp
+ * of the event that completed the hotkey */
+enum latency_stage {
+	LAT_READ, /* Event read by hkd */
+	LAT_MATCH, /* Hotkey matched, command sent to the executor */
+	LAT_EXEC, /* posix_spawn returned, which is after the child exec'd */
+	LAT_STAGES
+};
+
+/* Run stats of a hotkey, reported by the executor */
+struct hotkey_stats {
+	unsigned long runs; /* Number of times the command exited */
+	int status; /* Exit status of the last run */
+	long long runtime; /* Duration of the last run in milliseconds */
+	unsigned long hits; /* Number of times the hotkey matched */
+	struct histogram *latency; /* LAT_STAGES histograms, NULL until run */
+};
+
+/* Runtime counters, dumped with SIGUSR2. hkd is single threaded (the executor
+ * is a separate process) so they are plain integers */
+struct counters {
+	unsigned long long wakeups;
+	unsigned long long events; /* Read from the devices */
+	unsigned long long frames;
+	unsigned long long probes; /* Hotkeys compared by the matcher */
+	unsigned long long hits;
+	unsigned long long spawn_failures;
+	unsigned long long reloads;
+	unsigned long long reload_failures;
+	long long reload_us; /* Duration of the last reload */
+	long long reload_total_us;
+};
+
+/* Executor message: asks the executor process to run the command of hotkey
+ * id, the header is followed by the NUL separated words of the expanded
+ * command or, if late, by the command to be expanded */
+struct exec_msg {
+	unsigned int id;
+	unsigned int gen; /* config_gen when the message was prepared */
+	int late;
+	long long time; /* Kernel time of the triggering event, us */
+};
+
+/* Executor result: sent back to the daemon when the command of a hotkey
+ * exits */
+struct exec_result {
+	unsigned int id;
+	unsigned int gen;
+	int status; /* Exit status, 128 + signal number if killed, -1 if the
+	             * command could not be run */
+	long long runtime; /* milliseconds */
+	long long exec; /* LAT_EXEC latency in us */
+};
+
+/* Commands being run by the executor, each one is watched through a pidfd */
+struct exec_child {
+	pid_t pid;
+	int pidfd; /* -1 if pidfd_open is not supported, reaped on SIGCHLD */
+	unsigned int id;
+	unsigned int gen;
+	long long start;
+	long long exec;
+	struct exec_child *next;
+};
+
+struct device;
+
+/* Where the events of a device come from: an evdev node or a recorded stream.
+ * read() returns the number of events read, 0 at the end of the stream and -1
+ * if there is nothing to read right now */
+struct device_source {
+	ssize_t (*read) (struct device *, struct input_event *, size_t);
+	void (*set_mask) (struct device *);
+	void (*close) (struct device *);
+};
+
+/* Replay state of a recorded stream, either raw struct input_event or an
+ * event log written by -R, told apart by the magic at its start */
+enum replay_format {REPLAY_UNKNOWN, REPLAY_RAW, REPLAY_LOG};
+struct replay {
+	int in; /* Recorded stream */
+	int timer; /* Paces the stream, -1 for unpaced pipes */
+	int paced;
+	int eof;
+	enum replay_format format;
+	long long time; /* Time of the last event read from a log, in us */
+	long long offset; /* Monotonic time minus stream time, in us */
+	size_t start, end;
+	char buf[EV_READ_SIZE * sizeof(struct input_event)];
+};
+
+/* Event log written by -R. It starts with RECORD_MAGIC and a 32 bit version,
+ * followed by records made of varints. Each record starts with a tag: the
+ * device id shifted left by one, with the low bit set if the record names the
+ * device. A name record is followed by the name length and the name, an event
+ * record by the zigzag encoded timestamp delta from the previous event record
+ * in us, the event type, code and zigzag encoded value. The buffer is written
+ * out in large chunks, and only when the descriptor can take it without
+ * blocking, records that do not fit are dropped and counted */
+struct record_log {
+	int fd;
+	long long time; /* Time of the last event record, in us */
+	unsigned long dropped;
+	size_t len;
+	unsigned char buf[RECORD_BUF_SIZE];
+};
+
+/* Device list: linked list of the monitored input devices, the epoll event of
+ * each device points to its entry */
+struct device {
+	int fd; /* Descriptor in the epoll set */
+	char name[FILE_NAME_MAX_LENGTH + 1];
+	unsigned char key_b[KEY_CNT / 8 + 1]; /* EV_KEY capabilities */
+	const struct device_source *source;
+	struct replay *replay; /* NULL for evdev devices */
+	unsigned int id; /* Identifies the device in the event log */
+	unsigned long long events; /* Events read */
+	/* Read buffer, an incomplete frame at the end of a read stays at its
+	 * start until the next read completes it */
+	struct input_event ev[EV_READ_SIZE];
+	int pending; /* Events of the incomplete frame */
+	int dropped; /* The incomplete frame is discarded at its SYN_REPORT */
+	struct device *next;
+};
+
+/* Retry queue: devices that were just created or could not be opened yet,
+ * each one is tried again once its deadline expires */
+struct retry_queue_e {
+	char name[FILE_NAME_MAX_LENGTH + 1];
+	int tries;
+	long long deadline; /* CLOCK_MONOTONIC milliseconds */
+	struct retry_queue_e *next;
+};
+
+/* Trie of the ordered hotkeys over the press order, node TRIE_ROOT is the
+ * root and edges are kept in a hash table keyed by parent node and key. Each
+ * node lists the hotkeys whose keys lead to it. The edge table is kept at most
+ * half full, with room for as many nodes. */
+struct trie_edge {
+	unsigned int parent;
+	unsigned int child; /* TRIE_ROOT marks an empty slot */
+	unsigned short key;
+};
+
+/* Hotkey table: the hotkeys compiled from the config file along with their
+ * indexes. A reload compiles a new table off to the side and swaps it in
+ * only if the whole config is valid.
+ * The hotkeys are stored as a struct of arrays indexed by hotkey id (config
+ * order), allocated in a single block together with the table, while their
+ * commands and executor messages live in a string pool. */
+struct hotkey_table {
+	unsigned int num;
+	unsigned int cap; /* Hotkeys fitting in the arrays */
+	struct key_buffer *kb;
+	unsigned long long *hash; /* Chord hash of kb */
+	unsigned int *match_next; /* Next hotkey in the same chord table
+				   * bucket or trie node, or HOTKEY_NONE */
+	unsigned int *command; /* Offset of the command in the pool */
+	unsigned int *msg; /* Offset of the exec_msg in the pool */
+	unsigned int *msg_len;
+	unsigned char *flags;
+	struct hotkey_stats *stats;
+	char *pool;
+	size_t pool_len;
+	size_t pool_size;
+	unsigned int gen; /* config_gen of the load that compiled the table */
+	unsigned long size_mask; /* Bit n set if some hotkey has n + 1 keys */
+	/* Chord table: hash table indexing the fuzzy hotkeys by their chord
+	 * hash, so that a key press costs a single probe regardless of the
+	 * number of hotkeys */
+	unsigned int *chord_table;
+	unsigned long chord_table_mask;
+	unsigned int chord_num; /* Hotkeys in the chord table */
+	struct trie_edge *trie_edges;
+	unsigned long trie_edges_mask;
+	unsigned int *trie_accept;
+	unsigned int trie_size;
+	/* Keys used by the hotkeys, devices that can not emit any of them are
+	 * not monitored */
+	unsigned char bound_keys[KEY_CNT / 8 + 1];
+	/* Compiled config cache the arrays, pool and indexes point into, NULL
+	 * if they were allocated */
+	void *map;
+	size_t map_len;
 };
 
-struct hotkey_list_e *hotkey_list = NULL;
-unsigned long hotkey_size_mask = 0;
+/* Compiled config cache header, see hkdc_write(). It is followed by the
+ * arrays of a hotkey table (except the stats), the pool, the chord table, the
+ * trie edges and the trie accept lists, each one starting at a multiple of
+ * 8 bytes. The file is only valid for the machine and the build that wrote
+ * it. */
+struct hkdc_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int key_cnt; /* KEY_CNT of the build */
+	unsigned int header_size;
+	unsigned long long checksum; /* config_checksum() of the source */
+	unsigned long long num;
+	unsigned long long size_mask;
+	unsigned long long chord_table_size; /* Entries, 0 if there is none */
+	unsigned long long trie_edges_size;
+	unsigned long long trie_size;
+	unsigned long long pool_len;
+	unsigned char bound_keys[KEY_CNT / 8 + 1];
+};
+
+struct hotkey_table *hotkeys = NULL; /* Table in use */
+unsigned int config_gen = 0; /* Incremented on every config load */
+struct device *device_list = NULL;
+struct retry_queue_e *retry_queue = NULL;
+int ev_fd = -1; /* epoll descriptor */
+int event_watcher = -1; /* inotify descriptor for EVDEV_ROOT_DIR */
+int settle_timer = -1; /* timerfd firing at the first retry queue deadline */
+int signal_fd = -1; /* signalfd receiving all the handled signals */
+int reload_timer = -1; /* timerfd delaying the reload after a config change */
+int config_wd = -1; /* inotify watch on the directory of the config file */
+char config_path[PATH_MAX] = {0}; /* Config file in use */
+/* Keys used by the hotkeys plus the modifiers, the only key events the kernel
+ * is asked to deliver */
+unsigned char key_mask[KEY_CNT / 8 + 1] = {0};
+int key_mask_dirty = 0;
+int hotkeys_dirty = 0; /* The hotkey table was swapped */
 char *ext_config_file = NULL;
+char *cache_file = NULL; /* Compiled config cache, -C */
+char *replay_file = NULL; /* Recorded input stream, -r */
+int replay_paced = 0; /* Replay at the recorded speed, -p */
+struct record_log *record = NULL; /* Event log, -R */
+unsigned int device_next_id = 0;
+/* Spawn parameters shared by all the commands, see spawn_init() */
+posix_spawn_file_actions_t spawn_actions;
+posix_spawnattr_t spawn_attr;
+extern char **environ;
+/* Executor process and the socket used to send it exec_msg and receive
+ * exec_result */
+pid_t exec_pid = -1;
+int exec_sock = -1;
+unsigned int exec_pending = 0; /* Commands sent without a result yet */
 /* Global flags */
 int vflag = 0;
 int dead = 0; /* Exit flag */
+/* Syscalls issued while servicing the current wakeup, shown in verbose mode */
+unsigned long syscall_count = 0;
+struct counters counters = {0};
+char *runtime_dir = NULL; /* Where the stats file and the socket go, -s */
+/* Control socket, its clients are in a separate epoll set which is itself in
+ * the main one */
+struct control_client {
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE_MAX];
+	/* Replies not sent yet, the client is not read until they are */
+	char *out;
+	size_t out_len;
+	size_t out_off;
+	unsigned int events; /* Events it is waited for in control_ep */
+	int closing; /* Closed once its replies are sent */
+	struct control_client *next;
+};
+int control_fd = -1;
+int control_ep = -1;
+char control_path[PATH_MAX] = {0};
+struct control_client *control_clients = NULL;
+/* Kernel time of the frame being processed and time it was read at, us */
+long long frame_time = 0;
+long long read_time = 0;
 /* key buffer operations */
 int key_buffer_add (struct key_buffer*, unsigned short);
-int key_buffer_remove (struct key_buffer*, unsigned short);
-int key_buffer_compare_fuzzy (struct key_buffer *, struct key_buffer *);
-int key_buffer_compare (struct key_buffer *, struct key_buffer *);
 void key_buffer_reset (struct key_buffer *);
+/* key state operations */
+int key_state_press (struct key_state *, unsigned short);
+int key_state_release (struct key_state *, unsigned short);
+int key_state_contains (struct key_state *, struct key_buffer *);
+int key_state_compare_fuzzy (struct key_state *, struct key_buffer *);
+void key_state_reset (struct key_state *);
+void key_state_trie_sync (struct key_state *);
+unsigned long long key_hash (unsigned short);
 /* Other operations */
-void int_handler (int signum);
-void exec_command (char *);
-void parse_config_file (void);
-void update_descriptors_list (int **, int *);
+void handle_signals (void);
+void exec_command (struct hotkey_table *, unsigned int);
+void exec_results (void);
+void spawn_init (void);
+void executor_start (void);
+void executor_stop (void);
+void executor_run (int);
+pid_t executor_spawn (struct exec_msg *, size_t);
+void executor_reap (int, struct exec_child **, struct exec_child *, int);
+void latency_add (struct hotkey_stats *, enum latency_stage, long long);
+void latency_dump (void);
+void stats_dump (void);
+void stats_print (FILE *);
+const char * runtime_path (char *, size_t, const char *);
+/* control socket operations */
+void control_open (void);
+void control_handle (void);
+void control_read (struct control_client *);
+void control_command (struct control_client *, char *);
+void control_queue (struct control_client *, const char *, size_t);
+int control_flush (struct control_client *);
+void control_close (struct control_client *);
+void control_shutdown (void);
+int control_add (char *, const char **);
+void control_list (FILE *);
+void histogram_add (struct histogram *, unsigned long long);
+unsigned long long histogram_percentile (const struct histogram *, double);
+struct hotkey_table * parse_config_file (void);
+struct hotkey_table * parse_config (const char *, size_t);
+unsigned long long config_checksum (const char *, size_t);
+unsigned long long config_checksum_var (unsigned long long, const char *);
+struct hotkey_table * hkdc_load (const char *, unsigned long long);
+int hkdc_write (const struct hotkey_table *, const char *, unsigned long long);
+int hkdc_write_section (FILE *, const void *, size_t);
+void * hkdc_section (char *, size_t, size_t *, size_t);
+int hkdc_check (const struct hotkey_table *);
+int config_open (void);
+const char * parse_keys (const char *, const char *, struct key_buffer *);
+int config_load (void);
+void config_watch (void);
+void config_path_set (const char *);
+void config_reload_arm (void);
+int hotkey_table_diff (struct hotkey_table *, struct hotkey_table *, unsigned int *,
+	unsigned int *, unsigned int *, unsigned int *);
+int hotkey_table_patch (struct hotkey_table *, unsigned int *);
+int key_buffer_same_keys (struct key_buffer *, struct key_buffer *);
+void parse_error (const char *, ...);
+int update_descriptors_list (void);
+void handle_inotify_events (void);
+long long now_ms (void);
+long long now_us (void);
 void remove_lock (void);
 void die (const char *, ...);
 void usage (void);
-int prepare_epoll (int *, int, int);
+/* Installs an event mask on the device so that the kernel only delivers the
+ * key events in key_mask (and EV_SYN, which can not be masked), all the other
+ * event types are masked out entirely. When recording the device keeps the
+ * default mask, which passes every event, and frame_process() applies
+ * key_mask instead */
+void evdev_set_mask (struct device *dev)
+{
+	struct input_mask mask;
+
+	if (record)
+		return;
+
+	for (unsigned int type = EV_SYN + 1; type < EV_CNT; type++) {
+		mask.type = type;
+		mask.codes_size = type == EV_KEY ? sizeof(key_mask) : 0;
+		mask.codes_ptr = (unsigned long) key_mask;
+		syscall_count++;
+		if (ioctl(dev->fd, EVIOCSMASK, &mask) < 0) {
+			/* Kernels older than 4.4 do not support event masks */
+			if (vflag)
+				printf(yellow("Could not set event mask of device %s\n"),
+					dev->name);
+			return;
+		}
+	}
+}
+
+/* Computes key_mask from the hotkey table in use, the devices are updated by
+ * the main loop */
+void key_mask_update (void)
+{
+	memcpy(key_mask, hotkeys->bound_keys, sizeof(key_mask));
+	for (int i = 0; i < array_size_const(modifier_keys); i++)
+		set_bit(modifier_keys[i], key_mask);
+	key_mask_dirty = 1;
+}
+
+/* Returns non zero if the two key bitmaps have at least one key in common */
+int key_bits_intersect (const unsigned char *a, const unsigned char *b)
+{
+	for (int i = 0; i < KEY_CNT / 8 + 1; i++)
+		if (a[i] & b[i])
+			return 1;
+	return 0;
+}
+
+int prepare_epoll (void);
+int device_drain (struct device *, struct key_state *);
+void frame_process (struct input_event *, int, struct key_state *);
+void hotkey_match (struct key_state *);
 unsigned short key_to_code (char *);
+unsigned long key_name_hash (const char *, unsigned long);
 const char * code_to_name (unsigned int);
-/* hotkey list operations */
-void hotkey_list_add (struct hotkey_list_e *, struct key_buffer *, char *, int);
-void hotkey_list_destroy (struct hotkey_list_e *);
+/* device list operations */
+struct device * device_open (const char *);
+struct device * replay_open (const char *, int);
+void replay_arm (struct replay *, long long);
+void device_add (struct device *);
+struct device * device_find (const char *);
+void device_close (struct device *);
+void devices_reload (void);
+void device_set_mask (struct device *);
+ssize_t evdev_read (struct device *, struct input_event *, size_t);
+void evdev_set_mask (struct device *);
+void evdev_close (struct device *);
+ssize_t replay_read (struct device *, struct input_event *, size_t);
+void replay_set_mask (struct device *);
+void replay_close (struct device *);
+size_t replay_next (struct replay *, struct input_event *);
+/* event log operations */
+void record_open (const char *);
+void record_device (struct device *);
+void record_events (struct device *, const struct input_event *, size_t);
+void record_flush (void);
+void record_close (void);
+size_t varint_put (unsigned char *, unsigned long long);
+size_t varint_get (const unsigned char *, const unsigned char *, unsigned long long *);
+void key_mask_update (void);
+int key_bits_intersect (const unsigned char *, const unsigned char *);
+/* retry queue operations */
+void retry_queue_add (const char *);
+void retry_queue_remove (const char *);
+void retry_queue_run (void);
+void retry_queue_arm (void);
+/* hotkey table operations */
+struct hotkey_table * hotkey_table_new (unsigned int, size_t);
+int hotkey_table_add (struct hotkey_table *, struct key_buffer *, char *, int);
+size_t hotkey_table_pool_alloc (struct hotkey_table *, size_t);
+void hotkey_table_destroy (struct hotkey_table *);
+void chord_table_build (struct hotkey_table *);
+void chord_table_insert (struct hotkey_table *, unsigned int);
+void trie_build (struct hotkey_table *, unsigned long);
+void trie_insert (struct hotkey_table *, unsigned int);
+unsigned int trie_find (const struct hotkey_table *, const struct key_buffer *);
+int hotkey_insert (struct key_buffer *, char *, int);
+int hotkey_remove (unsigned int);
+void hotkey_table_grow (void);
+unsigned int trie_child (const struct hotkey_table *, unsigned int, unsigned short);
+struct trie_edge * trie_slot (const struct hotkey_table *, unsigned int, unsigned short);
 
 int main (int argc, char *argv[])
 {
-	int fd_num = 0;
-	int *fds = NULL;
 	int lock_file_descriptor;
 	int opc;
-	int ev_fd;
-	int event_watcher = inotify_init1(IN_NONBLOCK);
 	int dump = 0;
-	ssize_t read_b; 				/* Read buffer */
 	struct flock fl;
-	struct sigaction action;
-	struct input_event event;
-	struct key_buffer pb = {{0}, 0};	/* Pressed keys buffer */
+	sigset_t set;
+	static struct key_state pb;		/* Pressed keys */
 
 	/* Parse command line arguments */
-	while ((opc = getopt(argc, argv, "vc:dh")) != -1) {
+	while ((opc = getopt(argc, argv, "vc:C:r:R:s:pdh")) != -1) {
 		switch (opc) {
 		case 'v':
 			vflag = 1;
@@ -142,6 +607,21 @@ int main (int argc, char *argv[])
 				die("malloc in main():");
 			 strcpy(ext_config_file, optarg);
 			 break;
+		case 'C':
+			cache_file = optarg;
+			break;
+		case 'r':
+			replay_file = optarg;
+			break;
+		case 'p':
+			replay_paced = 1;
+			break;
+		case 'R':
+			record_open(optarg);
+			break;
+		case 's':
+			runtime_dir = optarg;
+			break;
 		case 'd':
 			dump = 1;
 			break;
@@ -152,146 +632,201 @@ int main (int argc, char *argv[])
 		}
 	}
 
-	/* Handle SIGINT */
+	/* Signals are blocked and read from signal_fd in the main loop, the
+	 * executor inherits the mask and adjusts it */
 	dead = 0;
-	memset(&action, 0, sizeof(action));
-	action.sa_handler = int_handler;
-	sigaction(SIGINT, &action, NULL);
-	sigaction(SIGUSR1, &action, NULL);
-	sigaction(SIGCHLD, &action, NULL);
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+		die("Could not block signals:");
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		die("Could not call signalfd:");
 
 	/* Parse config file */
-	parse_config_file();
-
-	/* Check if hkd is already running */
-	lock_file_descriptor = open(LOCK_FILE, O_RDWR | O_CREAT, 0600);
-	if (lock_file_descriptor < 0)
-		die("Can't open lock file:");
-	fl.l_start = 0;
-	fl.l_len = 0;
-	fl.l_type = F_WRLCK;
-	fl.l_whence = SEEK_SET;
-	if (fcntl(lock_file_descriptor, F_SETLK, &fl) < 0)
-		die("hkd is already running");
-	atexit(remove_lock);
+	if (config_load())
+		die("Could not load the config file");
+	spawn_init();
+	key_state_reset(&pb);
+
+	/* Check if hkd is already running, replays can run alongside it */
+	if (!replay_file) {
+		lock_file_descriptor = open(LOCK_FILE, O_RDWR | O_CREAT, 0600);
+		if (lock_file_descriptor < 0)
+			die("Can't open lock file:");
+		fl.l_start = 0;
+		fl.l_len = 0;
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		if (fcntl(lock_file_descriptor, F_SETLK, &fl) < 0)
+			die("hkd is already running");
+		atexit(remove_lock);
+	}
 
 	/* If a dump is requested print the hotkey list then exit */
 	if (dump) {
 		printf("DUMPING HOTKEY LIST\n\n");
-		for (struct hotkey_list_e *tmp = hotkey_list; tmp; tmp = tmp->next) {
+		for (unsigned int id = 0; id < hotkeys->num; id++) {
+			if (hotkeys->flags[id] & HOTKEY_REMOVED)
+				continue;
 			printf("Hotkey\n");
 			printf("\tKeys: ");
-			for (unsigned int i = 0; i < tmp->kb.size; i++)
-				printf("%s ", code_to_name(tmp->kb.buf[i]));
-			printf("\n\tMatching: %s\n", tmp->fuzzy ? "fuzzy" : "ordered");
-			printf("\tCommand: %s\n\n", tmp->command);
+			for (unsigned int i = 0; i < hotkeys->kb[id].size; i++)
+				printf("%s ", code_to_name(hotkeys->kb[id].buf[i]));
+			printf("\n\tMatching: %s\n",
+				hotkeys->flags[id] & HOTKEY_FUZZY ? "fuzzy" : "ordered");
+			printf("\tCommand: %s\n", hotkeys->pool + hotkeys->command[id]);
+			printf("\tExpansion: %s\n\n",
+				hotkeys->flags[id] & HOTKEY_LATE ? "on trigger" : "on load");
 		}
 		exit(EXIT_SUCCESS);
 	}
 
-	/* Load descriptors */
-	update_descriptors_list(&fds, &fd_num);
+	/* Start the executor before opening anything else */
+	executor_start();
 
-	/* Prepare directory update watcher */
+	/* Prepare directory update watcher, a replay does not use the
+	 * devices in EVDEV_ROOT_DIR */
+	event_watcher = inotify_init1(IN_NONBLOCK);
 	if (event_watcher < 0)
 		die("Could not call inotify_init:");
-	if (inotify_add_watch(event_watcher, EVDEV_ROOT_DIR, IN_CREATE | IN_DELETE) < 0)
+	if (!replay_file &&
+	    inotify_add_watch(event_watcher, EVDEV_ROOT_DIR, IN_CREATE | IN_DELETE) < 0)
 		die("Could not add /dev/input to the watch list:");
+	settle_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (settle_timer < 0)
+		die("Could not call timerfd_create:");
+	reload_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (reload_timer < 0)
+		die("Could not call timerfd_create:");
+	config_watch();
 
 	/* Prepare epoll list */
-	ev_fd = prepare_epoll(fds, fd_num, event_watcher);
+	ev_fd = prepare_epoll();
+
+	/* Replays can run alongside the daemon and its socket, unless they
+	 * are given their own runtime directory */
+	if (!replay_file || runtime_dir)
+		control_open();
+
+	/* Load descriptors */
+	if (replay_file)
+		replay_open(replay_file, replay_paced);
+	else if (!update_descriptors_list())
+		die("Could not open any devices, exiting");
+	key_mask_dirty = 0;
 
 	/* MAIN EVENT LOOP */
-	mainloop_begin:
 	for (;;) {
-		int t = 0;
-		static unsigned int prev_size;
-		static struct epoll_event ev_type;
-		struct hotkey_list_e *tmp;
-		char buf[EVENT_BUF_LEN];
+		int ev_num, hotplug = 0, retry = 0, sig = 0, reload = 0, control = 0;
+		static struct epoll_event ev_list[MAX_EVENTS];
+		struct device *dev;
 
 		/* On linux use epoll(2) as it gives better performance */
-		if (epoll_wait(ev_fd, &ev_type, fd_num, -1) < 0 || dead) {
+		ev_num = epoll_wait(ev_fd, ev_list, MAX_EVENTS, -1);
+		syscall_count = 1;
+		counters.wakeups++;
+		if (ev_num < 0) {
 			if (errno != EINTR)
 				break;
+			ev_num = 0;
 		}
 
-		if (ev_type.events != EPOLLIN)
-			continue;
-
-		if (read(event_watcher, buf, EVENT_BUF_LEN) >= 0) {
-			sleep(1); // wait for devices to settle
-			update_descriptors_list(&fds, &fd_num);
-			if (close(ev_fd) < 0)
-				die("Could not close event filedescriptors list (ev_fd):");
-			ev_fd = prepare_epoll(fds, fd_num, event_watcher);
-			goto mainloop_begin;
-		}
-
-		prev_size = pb.size;
-		for (int i = 0; i < fd_num; i++) {
-
-			read_b = read(fds[i], &event, sizeof(struct input_event));
-			if (read_b != sizeof(struct input_event)) continue;
-
-			/* Ignore touchpad events */
-			if (
-				event.type == EV_KEY &&
-				event.code != BTN_TOUCH &&
-				event.code != BTN_TOOL_FINGER &&
-				event.code != BTN_TOOL_DOUBLETAP &&
-				event.code != BTN_TOOL_TRIPLETAP
-				) {
-				switch (event.value) {
-				/* Key released */
-				case 0:
-					key_buffer_remove(&pb, event.code);
-					break;
-				/* Key pressed */
-				case 1:
-					key_buffer_add(&pb, event.code);
-					break;
-				}
+		/* Only service the descriptors that epoll reported as ready */
+		for (int i = 0; i < ev_num; i++) {
+			if (ev_list[i].data.ptr == &event_watcher) {
+				hotplug = 1;
+				continue;
+			}
+			if (ev_list[i].data.ptr == &settle_timer) {
+				retry = 1;
+				continue;
+			}
+			if (ev_list[i].data.ptr == &signal_fd) {
+				sig = 1;
+				continue;
+			}
+			if (ev_list[i].data.ptr == &reload_timer) {
+				reload = 1;
+				continue;
+			}
+			if (ev_list[i].data.ptr == &exec_sock) {
+				exec_results();
+				continue;
+			}
+			if (ev_list[i].data.ptr == &control_ep) {
+				control = 1;
+				continue;
 			}
-		}
-
-		if (pb.size <= prev_size)
-			continue;
 
-		if (vflag) {
-			printf("Pressed keys: ");
-			for (unsigned int i = 0; i < pb.size; i++)
-				printf("%s ", code_to_name(pb.buf[i]));
-			putchar('\n');
+			dev = ev_list[i].data.ptr;
+			/* The device went away before inotify told us, or the
+			 * recorded stream ended */
+			if (ev_list[i].events & EPOLLIN && device_drain(dev, &pb))
+				device_close(dev);
+			else if (ev_list[i].events & (EPOLLERR | EPOLLHUP))
+				device_close(dev);
 		}
-
-		if (hotkey_size_mask & 1 << (pb.size - 1)) {
-			for (tmp = hotkey_list; tmp != NULL; tmp = tmp->next) {
-				if (tmp->fuzzy)
-					t = key_buffer_compare_fuzzy(&pb, &tmp->kb);
-				else
-					t = key_buffer_compare(&pb, &tmp->kb);
-				if (t)
-					exec_command(tmp->command);
-
-			}
+		/* Handled last as it may free devices still referenced by the
+		 * events above */
+		if (hotplug)
+			handle_inotify_events();
+		if (retry)
+			retry_queue_run();
+		if (reload) {
+			unsigned long long expirations;
+			syscall_count++;
+			if (read(reload_timer, &expirations, sizeof(expirations)) > 0)
+				config_load();
+		}
+		if (control)
+			control_handle();
+		if (sig)
+			handle_signals();
+		/* A replay is over once all of its streams are and the
+		 * commands they triggered returned, show how it went */
+		if (replay_file && !device_list && !exec_pending) {
+			stats_dump();
+			latency_dump();
+			dead = 1;
+		}
+		if (dead)
+			break;
+		/* The config was reloaded, walk the new trie and update the
+		 * monitored devices if the bound keys changed */
+		if (hotkeys_dirty) {
+			key_state_trie_sync(&pb);
+			hotkeys_dirty = 0;
+		}
+		if (key_mask_dirty) {
+			devices_reload();
+			key_mask_dirty = 0;
 		}
 	}
 
-	// TODO: better child handling, for now all children receive the same
-	// interrupts as the father so everything should work fine
-	wait(NULL);
 	if (!dead)
 		fprintf(stderr, red("An error occured: %s\n"), errno ? strerror(errno): "idk");
+	executor_stop();
+	while (device_list)
+		device_close(device_list);
+	while (retry_queue)
+		retry_queue_remove(retry_queue->name);
 	close(ev_fd);
 	close(event_watcher);
-	for (int i = 0; i < fd_num; i++)
-		if (close(fds[i]) == -1)
-			die("Error closing file descriptors:");
+	close(settle_timer);
+	close(reload_timer);
+	close(signal_fd);
+	if (record)
+		record_close();
+	control_shutdown();
 	return 0;
 }
 
-/* Adds a keycode to the pressed buffer if it is not already present
+/* Adds a keycode to a key buffer if it is not already present
  * Returns non zero if the key was not added. */
 int key_buffer_add (struct key_buffer *pb, unsigned short key)
 {
@@ -308,487 +843,2968 @@ int key_buffer_add (struct key_buffer *pb, unsigned short key)
 	return 0;
 }
 
-/* Removes a keycode from a pressed buffer if it is present returns
- * non zero in case of failure (key not present or buffer empty). */
-int key_buffer_remove (struct key_buffer *pb, unsigned short key)
+void key_buffer_reset (struct key_buffer *kb)
 {
-	if (!pb) return 1;
+	kb->size = 0;
+	memset(kb->buf, 0, KEY_BUFFER_SIZE * sizeof(unsigned short));
+}
 
-	for (unsigned int i = 0; i < pb->size; i++) {
-		if (pb->buf[i] == key) {
-			pb->size--;
-			pb->buf[i] = pb->buf[pb->size];
-			return 0;
-		}
+/* Marks a key as pressed and appends it to the press order, returns non zero
+ * if the key was already pressed or is not a valid key code */
+int key_state_press (struct key_state *ks, unsigned short key)
+{
+	if (key >= KEY_CNT || test_bit(key, ks->bits))
+		return 1;
+	set_bit(key, ks->bits);
+	ks->prev[key] = ks->tail;
+	ks->next[key] = KEY_CNT;
+	if (ks->tail != KEY_CNT)
+		ks->next[ks->tail] = key;
+	else
+		ks->head = key;
+	ks->tail = key;
+	ks->size++;
+	ks->hash ^= key_hash(key);
+	if (ks->trie_node != TRIE_DEAD)
+		ks->trie_node = trie_child(hotkeys, ks->trie_node, key);
+	return 0;
+}
+
+/* Marks a key as released and unlinks it from the press order, returns non
+ * zero if the key was not pressed */
+int key_state_release (struct key_state *ks, unsigned short key)
+{
+	if (key >= KEY_CNT || !test_bit(key, ks->bits))
+		return 1;
+	clear_bit(key, ks->bits);
+	if (ks->prev[key] != KEY_CNT)
+		ks->next[ks->prev[key]] = ks->next[key];
+	else
+		ks->head = ks->next[key];
+	if (ks->next[key] != KEY_CNT)
+		ks->prev[ks->next[key]] = ks->prev[key];
+	else
+		ks->tail = ks->prev[key];
+	ks->size--;
+	ks->hash ^= key_hash(key);
+	key_state_trie_sync(ks);
+	return 0;
+}
+
+void key_state_reset (struct key_state *ks)
+{
+	memset(ks->bits, 0, sizeof(ks->bits));
+	ks->head = ks->tail = KEY_CNT;
+	ks->size = 0;
+	ks->hash = 0;
+	ks->trie_node = TRIE_ROOT;
+}
+
+/* Walks the trie along the press order, needed when a key in the middle of
+ * the order is released or when the trie is rebuilt */
+void key_state_trie_sync (struct key_state *ks)
+{
+	ks->trie_node = TRIE_ROOT;
+	key_state_foreach(k, ks) {
+		if ((ks->trie_node = trie_child(hotkeys, ks->trie_node, k)) == TRIE_DEAD)
+			break;
 	}
-	return 1;
 }
 
-void key_buffer_reset (struct key_buffer *kb)
+/* Hash of a single key (splitmix64 finalizer), the hash of a chord is the xor
+ * of the hashes of its keys, as such it does not depend on the key order and
+ * can be updated in constant time on every press and release */
+unsigned long long key_hash (unsigned short key)
 {
-	kb->size = 0;
-	memset(kb->buf, 0, KEY_BUFFER_SIZE * sizeof(unsigned short));
+	unsigned long long z = key + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
 }
 
-void int_handler (int signum)
+/* Services the signals queued on signal_fd, as they are blocked and never
+ * interrupt anything the config can be reloaded and children reaped from the
+ * main loop */
+void handle_signals (void)
 {
-	switch (signum) {
-	case SIGINT:
-		if (dead)
-			die("An error occured, exiting");
-		if (vflag)
-			printf(yellow("Received interrupt signal, exiting gracefully...\n"));
-		dead = 1;
-		break;
-	case SIGUSR1:
-		parse_config_file();
-		break;
-	case SIGCHLD:
-		wait(NULL);
-		break;
+	struct signalfd_siginfo si;
+
+	for (;;) {
+		syscall_count++;
+		if (read(signal_fd, &si, sizeof(si)) != sizeof(si))
+			return;
+		switch (si.ssi_signo) {
+		case SIGINT:
+		case SIGTERM:
+			if (vflag)
+				printf(yellow("Received interrupt signal, exiting gracefully...\n"));
+			dead = 1;
+			break;
+		case SIGUSR1:
+			config_load();
+			break;
+		case SIGUSR2:
+			stats_dump();
+			latency_dump();
+			break;
+		case SIGCHLD:
+			/* Only executors are children of the daemon */
+			while (waitpid(-1, NULL, WNOHANG) > 0);
+			break;
+		}
+	}
+}
+
+/* Hands the command of a hotkey to the executor process, the message was
+ * prepared when the config was loaded so the input loop never forks nor
+ * expands anything */
+void exec_command (struct hotkey_table *t, unsigned int id)
+{
+	struct exec_msg *msg = (struct exec_msg *) (t->pool + t->msg[id]);
+
+	t->stats[id].hits++;
+	counters.hits++;
+	latency_add(&t->stats[id], LAT_READ, read_time - frame_time);
+	latency_add(&t->stats[id], LAT_MATCH, now_us() - frame_time);
+	msg->time = frame_time;
+	for (int tries = 0; tries < 2; tries++) {
+		syscall_count++;
+		if (send(exec_sock, t->pool + t->msg[id], t->msg_len[id],
+		    MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) {
+			exec_pending++;
+			return;
+		}
+		/* The executor died, start a new one and try again */
+		if (errno != EPIPE && errno != ECONNRESET)
+			break;
+		executor_start();
 	}
+	counters.spawn_failures++;
+	fprintf(stderr, red("Could not run %s: %s\n"), t->pool + t->command[id],
+		strerror(errno));
 }
 
-/* Executes a command from a string */
-void exec_command (char *command)
+/* Reads the results sent back by the executor and records them in the
+ * hotkeys, results of a previous config are dropped */
+void exec_results (void)
 {
-	static wordexp_t result;
+	struct exec_result res;
+	struct hotkey_stats *st;
+	ssize_t len;
 
-	/* Expand the string for the program to run */
-	switch (wordexp (command, &result, 0)) {
-	case 0:
-		break;
-	case WRDE_NOSPACE:
-		/* If the error was WRDE_NOSPACE,
-		 * then perhaps part of the result was allocated */
-		wordfree (&result);
-		return;
-	default:
-		/* Some other error */
-		fprintf(stderr, "Could not parse, %s is not valid\n", command);
-		return;
+	for (;;) {
+		syscall_count++;
+		len = recv(exec_sock, &res, sizeof(res), MSG_DONTWAIT);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		/* The executor died, start a new one */
+		if (len <= 0) {
+			executor_start();
+			return;
+		}
+		if (len != sizeof(res))
+			continue;
+		if (exec_pending)
+			exec_pending--;
+		if (res.status < 0)
+			counters.spawn_failures++;
+		if (res.status < 0 || res.gen != hotkeys->gen || res.id >= hotkeys->num)
+			continue;
+		st = &hotkeys->stats[res.id];
+		st->runs++;
+		st->status = res.status;
+		st->runtime = res.runtime;
+		latency_add(st, LAT_EXEC, res.exec);
+		if (vflag)
+			printf("Hotkey %u exited with status %d after %lld ms\n",
+				res.id, res.status, res.runtime);
 	}
+}
 
-	pid_t cpid;
-	switch (cpid = fork()) {
+/* Forks the executor process, a previous executor exits as soon as it sees
+ * its socket closed */
+void executor_start (void)
+{
+	struct epoll_event ev;
+	int sv[2];
+
+	/* The commands sent to the previous one are lost */
+	if (exec_sock >= 0)
+		close(exec_sock);
+	exec_pending = 0;
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		die("Could not create the executor socket:");
+	/* Do not let the executor inherit buffered output */
+	fflush(NULL);
+
+	switch (exec_pid = fork()) {
 	case -1:
-		fprintf(stderr, "Could not create child process: %s", strerror(errno));
-		wordfree(&result);
+		die("Could not start the executor:");
 		break;
 	case 0:
-		/* This is the child process, execute the command */
-		execvp(result.we_wordv[0], result.we_wordv);
-		die("%s:", command);
+		close(sv[0]);
+		executor_run(sv[1]);
 		break;
 	default:
-		while (waitpid(cpid, NULL, WNOHANG) == -1) {}
-		wordfree(&result);
+		close(sv[1]);
+		exec_sock = sv[0];
 		break;
 	}
+
+	/* On restart, the first socket is added by prepare_epoll() */
+	if (ev_fd >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = &exec_sock;
+		if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, exec_sock, &ev) < 0)
+			die("Could not add file descriptor to the epoll list:");
+	}
 }
 
-void update_descriptors_list (int **fds, int *fd_num)
+/* Tells the executor that no more commands are coming and waits for it to
+ * exit. Its results are read until then, closing the socket with results left
+ * unread would reset the connection before the executor read all the commands
+ * that were sent to it */
+void executor_stop (void)
 {
-	struct dirent *file_ent;
-	char ev_path[sizeof(EVDEV_ROOT_DIR) + FILE_NAME_MAX_LENGTH + 1];
-	void *tmp_p;
-	int tmp_fd;
-	unsigned char evtype_b[EV_MAX];
-	/* Open the event directory */
-	DIR *ev_dir = opendir(EVDEV_ROOT_DIR);
-	if (!ev_dir)
-		die("Could not open /dev/input:");
+	struct exec_result res;
+	ssize_t len;
+
+	shutdown(exec_sock, SHUT_WR);
+	do
+		len = recv(exec_sock, &res, sizeof(res), 0);
+	while (len > 0 || (len < 0 && errno == EINTR));
+	close(exec_sock);
+	exec_sock = -1;
+	waitpid(exec_pid, NULL, 0);
+}
 
-	(*fd_num) = 0;
+/* Executor main loop: runs the commands sent by the daemon and reaps them as
+ * soon as their pidfd becomes readable, sending back their exit status and
+ * runtime. Never returns, uses _exit() so that the daemon's atexit handlers
+ * do not run in this process. */
+void executor_run (int sock)
+{
+	static unsigned long long buf[EXEC_MSG_MAX / sizeof(unsigned long long)];
+	struct exec_msg *msg = (void *) buf;
+	struct epoll_event ev, ev_list[MAX_EVENTS];
+	struct signalfd_siginfo si;
+	struct exec_child *children = NULL, *c, *next;
+	struct exec_result res;
+	struct sigaction action;
+	sigset_t set;
+	ssize_t len;
+	pid_t pid;
+	int ep, sfd = -1, ev_num, status;
+
+	/* _exit() does not flush */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* Drop what the daemon had open (when restarted) */
+	for (struct device *dev = device_list; dev; dev = dev->next) {
+		close(dev->fd);
+		if (dev->replay)
+			close(dev->replay->in);
+	}
+	if (record)
+		close(record->fd);
+	for (struct control_client *c = control_clients; c; c = c->next)
+		close(c->fd);
+	if (control_fd >= 0)
+		close(control_fd);
+	if (control_ep >= 0)
+		close(control_ep);
+	if (ev_fd >= 0)
+		close(ev_fd);
+	if (event_watcher >= 0)
+		close(event_watcher);
+	if (settle_timer >= 0)
+		close(settle_timer);
+	if (reload_timer >= 0)
+		close(reload_timer);
+	close(signal_fd);
+
+	/* Only keep SIGCHLD blocked, it is never handled unless pidfds are not
+	 * supported and then read through a signalfd */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_IGN;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGUSR1, &action, NULL);
+	sigaction(SIGUSR2, &action, NULL);
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_SETMASK, &set, NULL);
+
+	if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		_exit(EXIT_FAILURE);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev) < 0)
+		_exit(EXIT_FAILURE);
 
 	for (;;) {
-
-		if ((file_ent = readdir(ev_dir)) == NULL)
-			break;
-		/* Filter out non character devices */
-		if (file_ent->d_type != DT_CHR)
-			continue;
-
-		/* Compose absolute path from relative */
-		strncpy(ev_path, EVDEV_ROOT_DIR, sizeof(EVDEV_ROOT_DIR) + FILE_NAME_MAX_LENGTH);
-	   	strncat(ev_path, file_ent->d_name, sizeof(EVDEV_ROOT_DIR) + FILE_NAME_MAX_LENGTH);
-
-		/* Open device and check if it can give key events otherwise ignore it */
-		tmp_fd = open(ev_path, O_RDONLY | O_NONBLOCK);
-		if (tmp_fd < 0) {
-			if (vflag)
-				printf(red("Could not open device %s\n"), ev_path);
-			continue;
+		if ((ev_num = epoll_wait(ep, ev_list, MAX_EVENTS, -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			_exit(EXIT_FAILURE);
 		}
+		for (int i = 0; i < ev_num; i++) {
+			if (ev_list[i].data.ptr == &sfd) {
+				while (read(sfd, &si, sizeof(si)) > 0);
+				for (c = children; c; c = next) {
+					next = c->next;
+					if (c->pidfd < 0 && waitpid(c->pid, &status, WNOHANG) > 0)
+						executor_reap(sock, &children, c, status);
+				}
+				continue;
+			}
+			/* A child exited, its pidfd became readable. Closing the
+			 * pidfd is not enough to remove it from the epoll set if
+			 * the descriptor was duplicated, be explicit about it */
+			if ((c = ev_list[i].data.ptr)) {
+				epoll_ctl(ep, EPOLL_CTL_DEL, c->pidfd, NULL);
+				if (waitpid(c->pid, &status, 0) > 0)
+					executor_reap(sock, &children, c, status);
+				continue;
+			}
 
-		memset(evtype_b, 0, sizeof(evtype_b));
-		if (ioctl(tmp_fd, EVIOCGBIT(0, EV_MAX), evtype_b) < 0) {
-			if (vflag)
-				printf(red("Could not read capabilities of device %s\n"),ev_path);
-			close(tmp_fd);
-			continue;
+			/* A reset is reported before the messages still queued,
+			 * which are read and run before exiting on EOF */
+			len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+			if (!len)
+				_exit(EXIT_SUCCESS);
+			if (len < 0) {
+				if (errno == EAGAIN || errno == EINTR || errno == ECONNRESET)
+					continue;
+				_exit(EXIT_FAILURE);
+			}
+			if ((size_t) len <= sizeof(struct exec_msg))
+				continue;
+			if ((pid = executor_spawn(msg, len)) <= 0) {
+				res.id = msg->id;
+				res.gen = msg->gen;
+				res.status = -1;
+				res.runtime = res.exec = 0;
+				send(sock, &res, sizeof(res), MSG_DONTWAIT | MSG_NOSIGNAL);
+				continue;
+			}
+			if (!(c = malloc(sizeof(struct exec_child))))
+				continue;
+			c->pid = pid;
+			c->id = msg->id;
+			c->gen = msg->gen;
+			c->start = now_ms();
+			c->exec = now_us() - msg->time;
+			c->pidfd = syscall(SYS_pidfd_open, pid, 0);
+			ev.data.ptr = c;
+			if (c->pidfd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, c->pidfd, &ev) < 0) {
+				close(c->pidfd);
+				c->pidfd = -1;
+			}
+			c->next = children;
+			children = c;
+			/* Fall back to SIGCHLD on kernels older than 5.3, the
+			 * signal stayed pending if the child already exited */
+			if (c->pidfd < 0 && sfd < 0) {
+				sfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+				ev.data.ptr = &sfd;
+				if (sfd < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &ev) < 0)
+					_exit(EXIT_FAILURE);
+			}
 		}
+	}
+}
 
-		if (!test_bit(EV_KEY, evtype_b)) {
-			if (vflag)
-				printf(yellow("Ignoring device %s\n"), ev_path);
-			close(tmp_fd);
-			continue;
-		}
+/* Adds a latency sample of a hotkey, its histograms are only allocated once it
+ * runs so that big configs do not pay for them */
+void latency_add (struct hotkey_stats *st, enum latency_stage stage, long long us)
+{
+	if (us < 0)
+		us = 0;
+	if (!st->latency && !(st->latency = calloc(LAT_STAGES, sizeof(struct histogram))))
+		return;
+	histogram_add(&st->latency[stage], us);
+}
+
+/* Prints the counters and writes them to the stats file in the runtime
+ * directory, on SIGUSR2 */
+void stats_dump (void)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	FILE *f;
+	int fd;
 
-		tmp_p = realloc((*fds), sizeof(int) * ((*fd_num) + 1));
-		if (!tmp_p)
-			die("realloc file descriptors:");
-		(*fds) = (int *) tmp_p;
+	stats_print(stdout);
+	fflush(stdout);
 
-		(*fds)[(*fd_num)] = tmp_fd;
-		(*fd_num)++;
+	if (!runtime_path(path, sizeof(path), STATS_FILE))
+		return;
+	/* Replaced at once, readers never see a partial file. The temporary
+	 * file gets a fresh name, as root a fixed one in a shared directory
+	 * could be a symlink planted by someone else */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) < 0 || fchmod(fd, 0644) < 0 || !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, red("Could not write %s: %s\n"), path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		return;
 	}
-	closedir(ev_dir);
-	if (*fd_num) {
-		if (vflag)
-			printf(green("Monitoring %d devices\n"), *fd_num);
-	} else {
-		die("Could not open any devices, exiting");
+	stats_print(f);
+	if (fclose(f) || rename(tmp, path) < 0) {
+		fprintf(stderr, red("Could not write %s: %s\n"), path, strerror(errno));
+		unlink(tmp);
 	}
 }
 
-int prepare_epoll (int *fds, int fd_num, int event_watcher)
+/* Puts the path of name in the runtime directory in buf, returns NULL if it
+ * does not fit */
+const char * runtime_path (char *buf, size_t size, const char *name)
 {
- 	int ev_fd = epoll_create(1);
-	static struct epoll_event epoll_read_ev;
- 	epoll_read_ev.events = EPOLLIN;
- 	if (ev_fd < 0)
- 		die("epoll_create failed in prepare_epoll:");
- 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, event_watcher, &epoll_read_ev) < 0)
- 		die("Could not add file descriptor to the epoll list:");
- 	for (int i = 0; i < fd_num; i++)
- 		if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, fds[i], &epoll_read_ev) < 0)
- 			die("Could not add file descriptor to the epoll list:");
-	return ev_fd;
+	const char *dir = runtime_dir;
+
+	if (!dir && !(dir = getenv("XDG_RUNTIME_DIR")))
+		dir = "/tmp";
+	if ((size_t) snprintf(buf, size, "%s/%s", dir, name) >= size)
+		return NULL;
+	return buf;
 }
 
-/* Checks if two key buffers contain the same keys in no specified order */
-int key_buffer_compare_fuzzy (struct key_buffer *haystack, struct key_buffer *needle)
+/* One counter per line, as name and value */
+void stats_print (FILE *f)
 {
-	int ff = 0;
-	if (haystack->size != needle->size)
-		return 0;
-	for (int x = needle->size - 1; x >= 0; x--) {
-		for (unsigned int i = 0; i < haystack->size; i++)
-			ff += (needle->buf[x] == haystack->buf[i]);
-		if (!ff)
-			return 0;
-		ff = 0;
-	}
-	return 1;
+	fprintf(f, "wakeups %llu\n", counters.wakeups);
+	fprintf(f, "events %llu\n", counters.events);
+	fprintf(f, "frames %llu\n", counters.frames);
+	fprintf(f, "probes %llu\n", counters.probes);
+	fprintf(f, "hits %llu\n", counters.hits);
+	fprintf(f, "spawn_failures %llu\n", counters.spawn_failures);
+	fprintf(f, "reloads %llu\n", counters.reloads);
+	fprintf(f, "reload_failures %llu\n", counters.reload_failures);
+	fprintf(f, "reload_us %lld\n", counters.reload_us);
+	fprintf(f, "reload_total_us %lld\n", counters.reload_total_us);
+	for (struct device *dev = device_list; dev; dev = dev->next)
+		fprintf(f, "device %s events %llu\n", dev->name, dev->events);
+	for (unsigned int id = 0; id < hotkeys->num; id++)
+		if (hotkeys->stats[id].hits)
+			fprintf(f, "hotkey %u hits %lu runs %lu status %d\n", id,
+				hotkeys->stats[id].hits, hotkeys->stats[id].runs,
+				hotkeys->stats[id].status);
 }
 
-/* Checks if two key buffers are the same (same order) */
-int key_buffer_compare (struct key_buffer *haystack, struct key_buffer *needle)
+/* Listens on the control socket in the runtime directory. hkd works without
+ * it, so errors are only reported */
+void control_open (void)
 {
-	if (haystack->size != needle->size)
-		return 0;
-	for (unsigned int i = 0; i < needle->size; i++) {
-		if (needle->buf[i] != haystack->buf[i])
-			return 0;
+	struct sockaddr_un addr = {0};
+	struct epoll_event ev;
+
+	if (!runtime_path(control_path, sizeof(control_path), CONTROL_SOCKET) ||
+	    strlen(control_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, red("Control socket path too long\n"));
+		control_path[0] = '\0';
+		return;
 	}
-	return 1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, control_path);
+
+	/* The lock file tells that a socket left there is stale */
+	unlink(control_path);
+	control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (control_fd < 0 || bind(control_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    chmod(control_path, 0600) < 0 || listen(control_fd, 8) < 0) {
+		fprintf(stderr, red("Could not open the control socket %s: %s\n"),
+			control_path, strerror(errno));
+		control_shutdown();
+		return;
+	}
+
+	if ((control_ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		die("Could not call epoll_create:");
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(control_ep, EPOLL_CTL_ADD, control_fd, &ev) < 0)
+		die("Could not add file descriptor to the epoll list:");
+	ev.data.ptr = &control_ep;
+	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, control_ep, &ev) < 0)
+		die("Could not add file descriptor to the epoll list:");
+	if (vflag)
+		printf(green("Listening on %s\n"), control_path);
 }
 
-void hotkey_list_destroy (struct hotkey_list_e *head)
+/* Accepts the new clients and serves the ones that sent something */
+void control_handle (void)
 {
-	struct hotkey_list_e *tmp;
-	for (; head; free(tmp)) {
-		if (head->command)
-			free(head->command);
-		tmp = head;
-		head = head->next;
+	struct epoll_event ev, ev_list[MAX_EVENTS];
+	struct control_client *c;
+	int ev_num, fd;
+
+	syscall_count++;
+	if ((ev_num = epoll_wait(control_ep, ev_list, MAX_EVENTS, 0)) < 0)
+		return;
+	for (int i = 0; i < ev_num; i++) {
+		if ((c = ev_list[i].data.ptr)) {
+			if (ev_list[i].events & EPOLLOUT)
+				control_flush(c);
+			else
+				control_read(c);
+			continue;
+		}
+		while ((fd = accept(control_fd, NULL, NULL)) >= 0) {
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			if (!(c = calloc(1, sizeof(struct control_client)))) {
+				close(fd);
+				continue;
+			}
+			c->fd = fd;
+			c->events = ev.events = EPOLLIN;
+			ev.data.ptr = c;
+			if (epoll_ctl(control_ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+				close(fd);
+				free(c);
+				continue;
+			}
+			c->next = control_clients;
+			control_clients = c;
+		}
 	}
 }
 
-void hotkey_list_add (struct hotkey_list_e *head, struct key_buffer *kb, char *cmd, int f)
+/* Runs the complete lines sent by a client, one command per line */
+void control_read (struct control_client *c)
 {
-	int size;
-	struct hotkey_list_e *tmp;
-	if (!(size = strlen(cmd)))
+	char *line, *eol;
+	ssize_t len;
+
+	syscall_count++;
+	len = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1, MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
 		return;
-	if (!(tmp = malloc(sizeof(struct hotkey_list_e))))
-		die("Memory allocation failed in hotkey_list_add():");
-	if (!(tmp->command = malloc(size + 1)))
-		die("Memory allocation failed in hotkey_list_add():");
-	strcpy(tmp->command, cmd);
-	tmp->kb = *kb;
-	tmp->fuzzy = f;
-	tmp->next = NULL;
+	if (len <= 0) {
+		control_close(c);
+		return;
+	}
+	c->len += len;
+	c->buf[c->len] = '\0';
 
-	if (head) {
-		for (; head->next; head = head->next);
-		head->next = tmp;
-	} else
-		hotkey_list = tmp;
+	for (line = c->buf; (eol = strchr(line, '\n')); line = eol + 1) {
+		*eol = '\0';
+		control_command(c, line);
+	}
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len);
+	if (c->len == sizeof(c->buf) - 1) {
+		control_queue(c, "error line too long\n", 20);
+		c->closing = 1;
+		control_flush(c);
+		return;
+	}
+	control_flush(c);
 }
 
-void parse_config_file (void)
+/* Runs a command and queues the reply, which ends with a line starting with
+ * "ok" or "error" */
+void control_command (struct control_client *c, char *line)
 {
-	wordexp_t result = {0};
-	FILE *fd;
-	/* normal, skip line, get matching, get keys, get command, output */
-	enum {NORM, LINE_SKIP, GET_MATCH, GET_KEYS, GET_CMD, LAST} parse_state = NORM;
-	enum {CONT, NEW_BL, LAST_BL, END} block_state = CONT; /* continue, new block, last block, end */
-	int alloc_tmp = 0, alloc_size = 0;
-	int fuzzy = 0;
-	int i_tmp = 0, linenum = 1;
-	char block[BLOCK_SIZE + 1] = {0};
-	char *bb = NULL;
-	char *keys = NULL;
-	char *cmd = NULL;
-	char *cp_tmp = NULL;
-	struct key_buffer kb;
-	unsigned short us_tmp = 0;
-
-	key_buffer_reset(&kb);
-	if (ext_config_file) {
-		switch (wordexp(ext_config_file, &result, 0)) {
-		case 0:
-			break;
-		case WRDE_NOSPACE:
-			/* If the error was WRDE_NOSPACE,
-		 	 * then perhaps part of the result was allocated */
-			wordfree (&result);
-			die("Not enough space:");
-		default:
-			die("Path not valid:");
+	char *cmd, *arg, *reply = NULL, *end;
+	const char *err;
+	size_t len = 0;
+	unsigned long id;
+	FILE *f;
+	int ret;
+
+	if (!(f = open_memstream(&reply, &len)))
+		return;
+	for (cmd = line; isspace(*cmd); cmd++);
+	for (arg = cmd; *arg && !isspace(*arg); arg++);
+	if (*arg)
+		*arg++ = '\0';
+	while (isspace(*arg))
+		arg++;
+	id = strtoul(arg, &end, 10);
+
+	if (!strcmp(cmd, "add")) {
+		if ((ret = control_add(arg, &err)) < 0)
+			fprintf(f, "error %s\n", err);
+		else
+			fprintf(f, "ok %d\n", ret);
+	} else if (!strcmp(cmd, "remove")) {
+		if (end == arg || hotkey_remove(id))
+			fprintf(f, "error no such hotkey\n");
+		else
+			fprintf(f, "ok\n");
+	} else if (!strcmp(cmd, "list")) {
+		control_list(f);
+		fprintf(f, "ok\n");
+	} else if (!strcmp(cmd, "stats")) {
+		stats_print(f);
+		fprintf(f, "ok\n");
+	} else if (!strcmp(cmd, "trigger")) {
+		if (end == arg || id >= hotkeys->num || hotkeys->flags[id] & HOTKEY_REMOVED) {
+			fprintf(f, "error no such hotkey\n");
+		} else {
+			/* There is no kernel event, the latencies start now */
+			frame_time = read_time = now_us();
+			exec_command(hotkeys, id);
+			fprintf(f, "ok\n");
 		}
-
-		fd = fopen(result.we_wordv[0], "r");
-		wordfree(&result);
-		if (!fd)
-			die("Error opening config file:");
-		free(ext_config_file);
-		ext_config_file = NULL;
 	} else {
-		for (int i = 0; i < array_size_const(config_paths); i++) {
-			switch (wordexp(config_paths[i], &result, 0)) {
-			case 0:
-				break;
-			case WRDE_NOSPACE:
-				/* If the error was WRDE_NOSPACE,
-		 		 * then perhaps part of the result was allocated */
-				wordfree (&result);
-				die("Not enough space:");
-			default:
-				die("Path not valid:");
-			}
-
-			fd = fopen(result.we_wordv[0], "r");
-			wordfree(&result);
-			if (fd)
-				break;
-			if (vflag)
-				printf(yellow("config file not found at %s\n"), config_paths[i]);
-		}
-		if (!fd)
-			die("Could not open any config files, check the log for more details");
+		fprintf(f, "error unknown command %s\n", cmd);
 	}
+	if (!fclose(f))
+		control_queue(c, reply, len);
+	free(reply);
+}
 
-	hotkey_list_destroy(hotkey_list);
-	hotkey_list = NULL;
-	while (block_state != END) {
-		int tmp = 0;
-		memset(block, 0, BLOCK_SIZE + 1);
-		tmp = fread(block, sizeof(char), BLOCK_SIZE, fd);
-		if (!tmp)
-			break;
-		if (tmp < BLOCK_SIZE || feof(fd))
-			block_state = LAST_BL;
-		else
-			block_state = CONT;
-		bb = block;
-
-		while (block_state == CONT || block_state == LAST_BL) {
-			switch (parse_state) {
-			// First state
-			case NORM:
-				// remove whitespaces
-				while (isblank(*bb) && *bb)
-					bb++;
-				// get state
-				switch (*bb) {
-#if defined(__X86_64__) || defined(__i386__)
-				case EOF:
-#endif
-				case '\0':
-					// If it is the end of the last block exit
-					block_state = block_state == LAST_BL ? END : NEW_BL;
-					break;
-				case '\n':
-				case '#':
-					parse_state = LINE_SKIP;
-					break;
-				default:
-					parse_state = GET_MATCH;
-					break;
-				}
+/* Appends a reply to the ones waiting to be sent to a client */
+void control_queue (struct control_client *c, const char *reply, size_t len)
+{
+	char *out;
+
+	if (!(out = realloc(c->out, c->out_len + len)))
+		die("Memory allocation failed in control_queue():");
+	memcpy(out + c->out_len, reply, len);
+	c->out = out;
+	c->out_len += len;
+}
+
+/* Sends the queued replies of a client as far as its socket takes them, the
+ * rest is sent once it is writable again and the client is not read until
+ * then. Returns non zero if the client was closed */
+int control_flush (struct control_client *c)
+{
+	struct epoll_event ev;
+	ssize_t sent;
+
+	while (c->out_off < c->out_len) {
+		syscall_count++;
+		sent = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent < 0 && errno == EAGAIN)
+			break;
+		if (sent <= 0) {
+			control_close(c);
+			return 1;
+		}
+		c->out_off += sent;
+	}
+	if (c->out_off == c->out_len) {
+		free(c->out);
+		c->out = NULL;
+		c->out_len = c->out_off = 0;
+		if (c->closing) {
+			/* Input left unread would reset the connection ahead
+			 * of the reply, discard what is there already */
+			for (int i = 0; i < 16 && recv(c->fd, c->buf, sizeof(c->buf),
+			     MSG_DONTWAIT) > 0; i++);
+			control_close(c);
+			return 1;
+		}
+	}
+
+	ev.events = c->out ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = c;
+	if (ev.events != c->events) {
+		syscall_count++;
+		if (epoll_ctl(control_ep, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+			control_close(c);
+			return 1;
+		}
+		c->events = ev.events;
+	}
+	return 0;
+}
+
+/* Adds a hotkey given with the config file syntax, returns its id or -1 and
+ * points err to the reason */
+int control_add (char *line, const char **err)
+{
+	struct key_buffer kb;
+	char *colon, *cmd, *end;
+	int fuzzy, id;
+
+	switch (*line++) {
+	case '-':
+		fuzzy = 0;
+		break;
+	case '*':
+		fuzzy = 1;
+		break;
+	default:
+		*err = "missing marker";
+		return -1;
+	}
+	if (!(colon = strchr(line, ':'))) {
+		*err = "missing ':' after keys";
+		return -1;
+	}
+	if ((*err = parse_keys(line, colon, &kb)))
+		return -1;
+	for (cmd = colon + 1; isblank(*cmd); cmd++);
+	for (end = cmd + strlen(cmd); end > cmd && isspace(end[-1]); end--);
+	*end = '\0';
+	if (!*cmd) {
+		*err = "no command specified";
+		return -1;
+	}
+	if ((id = hotkey_insert(&kb, cmd, fuzzy)) < 0)
+		*err = "invalid command";
+	return id;
+}
+
+/* Lists the hotkeys in use with the config file syntax, prefixed by their id */
+void control_list (FILE *f)
+{
+	const struct hotkey_table *t = hotkeys;
+
+	for (unsigned int id = 0; id < t->num; id++) {
+		if (t->flags[id] & HOTKEY_REMOVED)
+			continue;
+		fprintf(f, "%u %c ", id, t->flags[id] & HOTKEY_FUZZY ? '*' : '-');
+		for (unsigned int i = 0; i < t->kb[id].size; i++)
+			fprintf(f, "%s%s", i ? "," : "", code_to_name(t->kb[id].buf[i]));
+		fprintf(f, ": %s%s\n", t->flags[id] & HOTKEY_LATE ? "@" : "",
+			t->pool + t->command[id]);
+	}
+}
+
+void control_close (struct control_client *c)
+{
+	struct control_client **tmp;
+
+	for (tmp = &control_clients; *tmp != c; tmp = &(*tmp)->next);
+	*tmp = c->next;
+	epoll_ctl(control_ep, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+/* Closes the control socket and its clients and removes the socket file */
+void control_shutdown (void)
+{
+	while (control_clients)
+		control_close(control_clients);
+	if (control_ep >= 0)
+		close(control_ep);
+	if (control_fd >= 0)
+		close(control_fd);
+	if (control_path[0])
+		unlink(control_path);
+	control_ep = control_fd = -1;
+	control_path[0] = '\0';
+}
+
+/* Prints the latency percentiles of the hotkeys that ran, on SIGUSR2 */
+void latency_dump (void)
+{
+	static const char *stage_names[LAT_STAGES] = {"read", "match", "exec"};
+	const struct histogram *h;
+
+	printf("Latency from the kernel event, us\n");
+	for (unsigned int id = 0; id < hotkeys->num; id++) {
+		if (!hotkeys->stats[id].latency)
+			continue;
+		printf("Hotkey %u: %s\n", id, hotkeys->pool + hotkeys->command[id]);
+		for (int stage = 0; stage < LAT_STAGES; stage++) {
+			h = &hotkeys->stats[id].latency[stage];
+			printf("\t%-6s n %llu p50 %llu p90 %llu p99 %llu max %llu\n",
+				stage_names[stage], h->count,
+				histogram_percentile(h, 0.5), histogram_percentile(h, 0.9),
+				histogram_percentile(h, 0.99), h->max);
+		}
+	}
+	fflush(stdout);
+}
+
+void histogram_add (struct histogram *h, unsigned long long v)
+{
+	unsigned int idx, shift;
+
+	if (v < 2 * HIST_SUB) {
+		idx = v;
+	} else {
+		shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+		idx = (shift + 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+		if (idx >= HIST_BUCKETS)
+			idx = HIST_BUCKETS - 1;
+	}
+	h->buckets[idx]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+/* Returns the highest value of the bucket holding the given percentile, or the
+ * maximum if lower */
+unsigned long long histogram_percentile (const struct histogram *h, double p)
+{
+	unsigned long long seen = 0, rank = p * h->count, v;
+	unsigned int idx, shift;
+
+	if (!h->count)
+		return 0;
+	for (idx = 0; idx < HIST_BUCKETS - 1; idx++)
+		if ((seen += h->buckets[idx]) > rank)
+			break;
+	if (idx == HIST_BUCKETS - 1)
+		return h->max;
+	if (idx < 2 * HIST_SUB)
+		return idx;
+	shift = idx / HIST_SUB - 1;
+	v = ((unsigned long long) (idx % HIST_SUB + HIST_SUB + 1) << shift) - 1;
+	return v < h->max ? v : h->max;
+}
+
+/* Removes an exited child from the list and sends its result to the
+ * daemon */
+void executor_reap (int sock, struct exec_child **list, struct exec_child *c, int status)
+{
+	struct exec_result res;
+
+	for (; *list != c; list = &(*list)->next);
+	*list = c->next;
+	res.id = c->id;
+	res.gen = c->gen;
+	res.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+	res.runtime = now_ms() - c->start;
+	res.exec = c->exec;
+	if (vflag)
+		printf("Child %d exited with status %d\n", c->pid, res.status);
+	send(sock, &res, sizeof(res), MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (c->pidfd >= 0)
+		close(c->pidfd);
+	free(c);
+}
+
+/* Runs the command in an executor message, returns the pid of the command or
+ * -1 if it could not be started */
+pid_t executor_spawn (struct exec_msg *msg, size_t len)
+{
+	wordexp_t result;
+	char *words = (char *) msg + sizeof(struct exec_msg);
+	char **argv;
+	size_t argc = 0;
+	pid_t cpid = -1;
+	int err;
+
+	/* Make sure that the last word is terminated */
+	((char *) msg)[len - 1] = '\0';
+	if (msg->late) {
+		switch (wordexp (words, &result, 0)) {
+		case 0:
+			break;
+		case WRDE_NOSPACE:
+			/* If the error was WRDE_NOSPACE,
+			 * then perhaps part of the result was allocated */
+			wordfree (&result);
+			return -1;
+		default:
+			/* Some other error */
+			fprintf(stderr, "Could not parse, %s is not valid\n", words);
+			return -1;
+		}
+		if (!result.we_wordc) {
+			wordfree(&result);
+			return -1;
+		}
+		argv = result.we_wordv;
+	} else {
+		for (char *p = words; p < (char *) msg + len; p += strlen(p) + 1)
+			argc++;
+		if (!(argv = malloc((argc + 1) * sizeof(char *))))
+			return -1;
+		argc = 0;
+		for (char *p = words; p < (char *) msg + len; p += strlen(p) + 1)
+			argv[argc++] = p;
+		argv[argc] = NULL;
+	}
+
+	/* posix_spawn shares the address space with the child until it calls
+	 * exec (CLONE_VM | CLONE_VFORK on linux), so unlike fork its cost does
+	 * not grow with the size of the process */
+	err = posix_spawnp(&cpid, argv[0], &spawn_actions, &spawn_attr, argv, environ);
+	if (err) {
+		fprintf(stderr, red("Could not execute %s: %s\n"), argv[0], strerror(err));
+		cpid = -1;
+	} else if (vflag) {
+		printf("Hotkey %u started %s as %d\n", msg->id, argv[0], cpid);
+	}
+
+	if (msg->late)
+		wordfree(&result);
+	else
+		free(argv);
+	return cpid;
+}
+
+/* Prepares the spawn parameters once: children get stdin from /dev/null,
+ * the default signal dispositions and an empty signal mask */
+void spawn_init (void)
+{
+	sigset_t set;
+
+	if (posix_spawn_file_actions_init(&spawn_actions) ||
+	    posix_spawn_file_actions_addopen(&spawn_actions, STDIN_FILENO,
+		"/dev/null", O_RDONLY, 0))
+		die("Could not prepare spawn file actions");
+	if (posix_spawnattr_init(&spawn_attr))
+		die("Could not prepare spawn attributes");
+	sigemptyset(&set);
+	posix_spawnattr_setsigmask(&spawn_attr, &set);
+	/* The executor ignores or blocks these, the commands get them back */
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, SIGCHLD);
+	posix_spawnattr_setsigdefault(&spawn_attr, &set);
+	posix_spawnattr_setflags(&spawn_attr,
+		POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+/* Opens all the usable devices in EVDEV_ROOT_DIR that are not already open,
+ * used at startup and on config reload as devices added or removed later are
+ * handled one by one through inotify. Returns the number of opened devices. */
+int update_descriptors_list (void)
+{
+	struct dirent *file_ent;
+	int dev_num = 0;
+	/* Open the event directory */
+	DIR *ev_dir = opendir(EVDEV_ROOT_DIR);
+	if (!ev_dir)
+		die("Could not open /dev/input:");
+
+	while ((file_ent = readdir(ev_dir))) {
+		/* Filter out non character devices */
+		if (file_ent->d_type != DT_CHR || device_find(file_ent->d_name))
+			continue;
+		if (device_open(file_ent->d_name))
+			dev_num++;
+	}
+	closedir(ev_dir);
+	if (dev_num && vflag)
+		printf(green("Monitoring %d new devices\n"), dev_num);
+	return dev_num;
+}
+
+/* Reads the pending inotify events and only opens or closes the devices that
+ * were created or deleted, all the others are left untouched. Created devices
+ * are not opened right away but queued, to let udev set them up. */
+void handle_inotify_events (void)
+{
+	static char buf[EVENT_BUF_LEN]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	struct device *dev;
+	ssize_t len;
+
+	for (;;) {
+		syscall_count++;
+		if ((len = read(event_watcher, buf, EVENT_BUF_LEN)) <= 0)
+			return;
+		for (char *p = buf; p < buf + len; p += EVENT_SIZE + event->len) {
+			event = (struct inotify_event *) p;
+			if (!event->len || event->mask & IN_ISDIR)
+				continue;
+			if (event->wd == config_wd) {
+				if (!strcmp(event->name, strrchr(config_path, '/') + 1))
+					config_reload_arm();
+				continue;
+			}
+			if (event->mask & IN_CREATE) {
+				retry_queue_add(event->name);
+			} else if (event->mask & IN_DELETE) {
+				retry_queue_remove(event->name);
+				if ((dev = device_find(event->name)))
+					device_close(dev);
+			}
+		}
+		retry_queue_arm();
+	}
+}
+
+long long now_ms (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long now_us (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Queues a newly created device, a burst of creations (e.g. a hub being
+ * plugged in) postpones all the first attempts so that they are made together
+ * once the burst is over */
+void retry_queue_add (const char *name)
+{
+	struct retry_queue_e *tmp;
+	long long deadline = now_ms() + SETTLE_DELAY_MS;
+
+	for (tmp = retry_queue; tmp; tmp = tmp->next) {
+		if (!tmp->tries)
+			tmp->deadline = deadline;
+		if (!strcmp(tmp->name, name))
+			return;
+	}
+
+	if (!(tmp = malloc(sizeof(struct retry_queue_e))))
+		die("Memory allocation failed in retry_queue_add():");
+	strncpy(tmp->name, name, FILE_NAME_MAX_LENGTH);
+	tmp->name[FILE_NAME_MAX_LENGTH] = '\0';
+	tmp->tries = 0;
+	tmp->deadline = deadline;
+	tmp->next = retry_queue;
+	retry_queue = tmp;
+}
+
+void retry_queue_remove (const char *name)
+{
+	struct retry_queue_e **tmp, *e;
+
+	for (tmp = &retry_queue; *tmp; tmp = &(*tmp)->next) {
+		if (!strcmp((*tmp)->name, name)) {
+			e = *tmp;
+			*tmp = e->next;
+			free(e);
+			return;
+		}
+	}
+}
+
+/* Tries to open the queued devices whose deadline expired, devices that fail
+ * to open (usually because udev has not fixed the permissions yet) are tried
+ * again later doubling the delay each time, up to RETRY_MAX times */
+void retry_queue_run (void)
+{
+	struct retry_queue_e **tmp, *e;
+	unsigned long long expirations;
+	long long now = now_ms();
+
+	syscall_count++;
+	if (read(settle_timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		return;
+
+	for (tmp = &retry_queue; (e = *tmp);) {
+		if (e->deadline > now) {
+			tmp = &e->next;
+			continue;
+		}
+		if (device_find(e->name)) {
+			/* A config reload opened it meanwhile */
+		} else if (device_open(e->name)) {
+			if (vflag)
+				printf(green("Added device %s\n"), e->name);
+		} else if (errno && errno != ENOENT && ++e->tries < RETRY_MAX) {
+			e->deadline = now + ((long long) SETTLE_DELAY_MS << e->tries);
+			tmp = &e->next;
+			continue;
+		} else if (errno && vflag) {
+			printf(red("Giving up on device %s\n"), e->name);
+		}
+		*tmp = e->next;
+		free(e);
+	}
+	retry_queue_arm();
+}
+
+/* Arms the settle timer for the earliest deadline in the retry queue, or
+ * disarms it if the queue is empty */
+void retry_queue_arm (void)
+{
+	struct itimerspec its = {{0, 0}, {0, 0}};
+	long long deadline = 0;
+
+	for (struct retry_queue_e *tmp = retry_queue; tmp; tmp = tmp->next)
+		if (!deadline || tmp->deadline < deadline)
+			deadline = tmp->deadline;
+	if (deadline) {
+		its.it_value.tv_sec = deadline / 1000;
+		its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+	}
+	syscall_count++;
+	if (timerfd_settime(settle_timer, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		die("Could not arm the settle timer:");
+}
+
+const struct device_source evdev_source = {
+	evdev_read, evdev_set_mask, evdev_close
+};
+const struct device_source replay_source = {
+	replay_read, replay_set_mask, replay_close
+};
+
+/* Opens a device in EVDEV_ROOT_DIR and, if it can give key events, adds it to
+ * the device list and to the epoll set. Returns NULL if the device is not
+ * usable, errno is set if it could not be opened or probed and zero if it was
+ * ignored. */
+struct device * device_open (const char *name)
+{
+	char ev_path[sizeof(EVDEV_ROOT_DIR) + FILE_NAME_MAX_LENGTH + 1];
+	unsigned char evtype_b[EV_MAX];
+	unsigned char key_b[KEY_CNT / 8 + 1];
+	struct device *dev;
+	int clk;
+	int tmp_fd;
+	int err;
+
+	/* Compose absolute path from relative */
+	strncpy(ev_path, EVDEV_ROOT_DIR, sizeof(EVDEV_ROOT_DIR) + FILE_NAME_MAX_LENGTH);
+	strncat(ev_path, name, FILE_NAME_MAX_LENGTH);
+
+	/* Open device and check if it can give key events otherwise ignore it */
+	tmp_fd = open(ev_path, O_RDONLY | O_NONBLOCK);
+	if (tmp_fd < 0) {
+		/* The caller decides whether to retry from errno, keep it
+		 * from being clobbered by printf */
+		err = errno;
+		if (vflag)
+			printf(red("Could not open device %s\n"), ev_path);
+		errno = err;
+		return NULL;
+	}
+
+	memset(evtype_b, 0, sizeof(evtype_b));
+	if (ioctl(tmp_fd, EVIOCGBIT(0, EV_MAX), evtype_b) < 0) {
+		err = errno;
+		if (vflag)
+			printf(red("Could not read capabilities of device %s\n"),ev_path);
+		close(tmp_fd);
+		errno = err;
+		return NULL;
+	}
+
+	if (!test_bit(EV_KEY, evtype_b)) {
+		if (vflag)
+			printf(yellow("Ignoring device %s\n"), ev_path);
+		close(tmp_fd);
+		errno = 0;
+		return NULL;
+	}
+
+	/* Devices that can not emit any of the bound keys (mice, power
+	 * buttons, lid switches...) can never complete a hotkey */
+	memset(key_b, 0, sizeof(key_b));
+	if (ioctl(tmp_fd, EVIOCGBIT(EV_KEY, KEY_MAX), key_b) < 0) {
+		err = errno;
+		if (vflag)
+			printf(red("Could not read capabilities of device %s\n"),ev_path);
+		close(tmp_fd);
+		errno = err;
+		return NULL;
+	}
+
+	if (!key_bits_intersect(key_b, hotkeys->bound_keys)) {
+		if (vflag)
+			printf(yellow("Ignoring device %s, no bound keys\n"), ev_path);
+		close(tmp_fd);
+		errno = 0;
+		return NULL;
+	}
+
+	if (!(dev = malloc(sizeof(struct device))))
+		die("Memory allocation failed in device_open():");
+	dev->fd = tmp_fd;
+	strncpy(dev->name, name, FILE_NAME_MAX_LENGTH);
+	dev->name[FILE_NAME_MAX_LENGTH] = '\0';
+	memcpy(dev->key_b, key_b, sizeof(key_b));
+	dev->source = &evdev_source;
+	dev->replay = NULL;
+	device_add(dev);
+
+	/* Latencies are measured against CLOCK_MONOTONIC, the kernel stamps
+	 * events with CLOCK_REALTIME unless told otherwise */
+	clk = CLOCK_MONOTONIC;
+	if (ioctl(dev->fd, EVIOCSCLOCKID, &clk) < 0 && vflag)
+		printf(yellow("Could not set the clock of device %s\n"), dev->name);
+	return dev;
+}
+
+/* Opens a recorded stream of struct input_event, "-" being the standard input,
+ * as a device that can emit any key. Pipes are polled directly unless paced,
+ * files are always readable so they are driven by a timer instead */
+struct device * replay_open (const char *path, int paced)
+{
+	struct replay *r;
+	struct device *dev;
+	struct stat st;
+	int in;
+
+	if (!strcmp(path, "-")) {
+		in = STDIN_FILENO;
+		if (fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK) < 0)
+			die("Could not make the standard input non blocking:");
+	} else if ((in = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+		die("Could not open %s:", path);
+	}
+	if (fstat(in, &st) < 0)
+		die("Could not stat %s:", path);
+
+	if (!(r = malloc(sizeof(struct replay))) || !(dev = malloc(sizeof(struct device))))
+		die("Memory allocation failed in replay_open():");
+	r->in = in;
+	r->timer = -1;
+	r->paced = paced;
+	r->eof = 0;
+	r->format = REPLAY_UNKNOWN;
+	r->time = 0;
+	r->offset = LLONG_MIN;
+	r->start = r->end = 0;
+	if (paced || S_ISREG(st.st_mode)) {
+		r->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (r->timer < 0)
+			die("Could not call timerfd_create:");
+		replay_arm(r, 0);
+	}
+
+	dev->fd = r->timer >= 0 ? r->timer : r->in;
+	strncpy(dev->name, path, FILE_NAME_MAX_LENGTH);
+	dev->name[FILE_NAME_MAX_LENGTH] = '\0';
+	memset(dev->key_b, 0xff, sizeof(dev->key_b));
+	dev->source = &replay_source;
+	dev->replay = r;
+	device_add(dev);
+	if (vflag)
+		printf(green("Replaying %s%s\n"), path, paced ? " at recorded speed" : "");
+	return dev;
+}
+
+/* Arms the replay timer at the given CLOCK_MONOTONIC time in us, a time in the
+ * past (like 0) makes it expire right away */
+void replay_arm (struct replay *r, long long at)
+{
+	struct itimerspec its = {0};
+
+	if (at < 1)
+		at = 1;
+	its.it_value.tv_sec = at / 1000000;
+	its.it_value.tv_nsec = (at % 1000000) * 1000;
+	syscall_count++;
+	if (timerfd_settime(r->timer, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		die("Could not arm the replay timer:");
+}
+
+/* Opens the event log. O_NONBLOCK only matters for pipes and FIFOs, writes
+ * to a regular file can still wait on the disk, the log is buffered so that
+ * this happens once per RECORD_BUF_SIZE / 2 bytes at most */
+void record_open (const char *path)
+{
+	if (!(record = malloc(sizeof(struct record_log))))
+		die("Memory allocation failed in record_open():");
+	record->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+	if (record->fd < 0)
+		die("Could not open %s:", path);
+	record->time = 0;
+	record->dropped = 0;
+	memcpy(record->buf, RECORD_MAGIC, 4);
+	record->buf[4] = RECORD_VERSION;
+	record->buf[5] = record->buf[6] = record->buf[7] = 0;
+	record->len = 8;
+}
+
+/* Names a device in the event log, its ids are never reused */
+void record_device (struct device *dev)
+{
+	size_t name_len = strlen(dev->name);
+	unsigned char *p;
+
+	if (RECORD_BUF_SIZE - record->len < RECORD_MAX + name_len) {
+		record_flush();
+		if (RECORD_BUF_SIZE - record->len < RECORD_MAX + name_len) {
+			record->dropped++;
+			return;
+		}
+	}
+	p = record->buf + record->len;
+	p += varint_put(p, (unsigned long long) dev->id << 1 | 1);
+	p += varint_put(p, name_len);
+	memcpy(p, dev->name, name_len);
+	record->len = p + name_len - record->buf;
+}
+
+/* Appends the events read from a device, as read, to the event log */
+void record_events (struct device *dev, const struct input_event *ev, size_t n)
+{
+	unsigned char *p;
+	long long t, dt;
+
+	for (size_t i = 0; i < n; i++) {
+		if (RECORD_BUF_SIZE - record->len < RECORD_MAX) {
+			record->dropped += n - i;
+			break;
+		}
+		t = ev[i].input_event_sec * 1000000LL + ev[i].input_event_usec;
+		dt = t - record->time;
+		record->time = t;
+		p = record->buf + record->len;
+		p += varint_put(p, (unsigned long long) dev->id << 1);
+		p += varint_put(p, (unsigned long long) dt << 1 ^ (unsigned long long) (dt >> 63));
+		p += varint_put(p, ev[i].type);
+		p += varint_put(p, ev[i].code);
+		p += varint_put(p, (unsigned int) ev[i].value << 1 ^ (unsigned int) (ev[i].value >> 31));
+		record->len = p - record->buf;
+	}
+	/* Write in large chunks, leaving room for what comes while the
+	 * descriptor is busy */
+	if (record->len >= RECORD_BUF_SIZE / 2)
+		record_flush();
+}
+
+/* Writes out as much of the event log buffer as the descriptor takes */
+void record_flush (void)
+{
+	ssize_t len;
+	size_t off = 0;
+
+	while (off < record->len) {
+		syscall_count++;
+		if ((len = write(record->fd, record->buf + off, record->len - off)) <= 0)
+			break;
+		off += len;
+	}
+	if (off < record->len && errno != EAGAIN && vflag)
+		printf(red("Could not write the event log: %s\n"), strerror(errno));
+	memmove(record->buf, record->buf + off, record->len - off);
+	record->len -= off;
+}
+
+void record_close (void)
+{
+	int flags;
+
+	/* Nothing is waiting on the main loop anymore */
+	flags = fcntl(record->fd, F_GETFL);
+	if (flags >= 0)
+		fcntl(record->fd, F_SETFL, flags & ~O_NONBLOCK);
+	record_flush();
+	if (record->dropped)
+		fprintf(stderr, yellow("%lu records did not fit in the event log\n"),
+			record->dropped);
+	close(record->fd);
+	free(record);
+	record = NULL;
+}
+
+/* LEB128, 7 bits per byte, the high bit marks that more bytes follow */
+size_t varint_put (unsigned char *p, unsigned long long v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns the length of the varint at p or 0 if it is not complete */
+size_t varint_get (const unsigned char *p, const unsigned char *end, unsigned long long *v)
+{
+	size_t n = 0;
+
+	*v = 0;
+	while (p + n < end && n < 10) {
+		*v |= (unsigned long long) (p[n] & 0x7f) << 7 * n;
+		if (!(p[n++] & 0x80))
+			return n;
+	}
+	return 0;
+}
+
+/* Adds an opened device to the epoll set and to the device list */
+void device_add (struct device *dev)
+{
+	struct epoll_event epoll_read_ev;
+
+	device_set_mask(dev);
+
+	epoll_read_ev.events = EPOLLIN;
+	epoll_read_ev.data.ptr = dev;
+	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, dev->fd, &epoll_read_ev) < 0)
+		die("Could not add file descriptor to the epoll list:");
+
+	dev->next = device_list;
+	device_list = dev;
+	dev->id = device_next_id++;
+	dev->events = 0;
+	dev->pending = dev->dropped = 0;
+	if (record)
+		record_device(dev);
+}
+
+void device_set_mask (struct device *dev)
+{
+	dev->source->set_mask(dev);
+}
+
+ssize_t evdev_read (struct device *dev, struct input_event *ev, size_t n)
+{
+	ssize_t len;
+
+	syscall_count++;
+	if ((len = read(dev->fd, ev, n * sizeof(struct input_event))) < 0)
+		return -1;
+	/* evdev never reports the end of the stream, on removal the read fails */
+	return len ? len / (ssize_t) sizeof(struct input_event) : -1;
+}
+
+void evdev_close (struct device *dev)
+{
+	if (close(dev->fd) < 0 && vflag)
+		printf(red("Error closing device %s\n"), dev->name);
+}
+
+/* Reads the events that are due from a recorded stream. The events that the
+ * kernel would have masked out on a live device are dropped here */
+ssize_t replay_read (struct device *dev, struct input_event *ev, size_t n)
+{
+	struct replay *r = dev->replay;
+	struct input_event e;
+	unsigned long long expirations;
+	long long t, now = 0;
+	size_t got = 0;
+	ssize_t len;
+
+	/* Only clears the expiration, the events tell what is due */
+	if (r->timer >= 0) {
+		syscall_count++;
+		if (read(r->timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+			return -1;
+	}
+
+	while (got < n) {
+		if (!(len = replay_next(r, &e))) {
+			if (r->eof)
 				break;
-			// Skip line (comment)
-			case 1:
-				while (*bb != '\n' && *bb)
-					bb++;
-				if (*bb) {
-					bb++;
-					linenum++;
-					parse_state = NORM;
-				} else {
-					block_state = NEW_BL;
-				}
+			memmove(r->buf, r->buf + r->start, r->end - r->start);
+			r->end -= r->start;
+			r->start = 0;
+			syscall_count++;
+			len = read(r->in, r->buf + r->end, sizeof(r->buf) - r->end);
+			if (len > 0) {
+				r->end += len;
+				continue;
+			}
+			if (len < 0) {
+				/* A paced pipe is not in the epoll set, check it
+				 * later */
+				if (errno == EAGAIN && r->timer >= 0)
+					replay_arm(r, now_us() + REPLAY_POLL_MS * 1000);
 				break;
-			// Get compairson method
-			case 2:
-				switch (*bb) {
-				case '-':
-					fuzzy = 0;
-					break;
-				case '*':
-					fuzzy = 1;
-					break;
-				default:
-					die("Error at line %d: "
-					"hotkey definition must start with '-' or '*'",
-					linenum);
-					break;
-				}
-				bb++;
-				parse_state = GET_KEYS;
+			}
+			/* Look at what is left once more, a stream shorter
+			 * than the log header is still raw events */
+			r->eof = 1;
+			continue;
+		}
+
+		t = e.input_event_sec * 1000000LL + e.input_event_usec;
+		if (r->paced) {
+			if (!now)
+				now = now_us();
+			/* The first event sets the time base */
+			if (r->offset == LLONG_MIN)
+				r->offset = now - t;
+			if (t + r->offset > now) {
+				replay_arm(r, t + r->offset);
 				break;
-			// Get keys
-			case 3:
-				if (!keys) {
-					if (!(keys = malloc(alloc_size = (sizeof(char) * 64))))
-						die("malloc for keys in parse_config_file():");
-					memset(keys, 0, alloc_size);
-				} else if (alloc_tmp >= alloc_size) {
-					if (!(keys = realloc(keys, alloc_size = alloc_size * 2)))
-						die("realloc for keys in parse_config_file():");
-					memset(&keys[alloc_size / 2], 0, alloc_size / 2);
-				}
+			}
+		}
+		r->start += len;
+		r->time = t;
+		/* Delivered now, as far as latencies are concerned */
+		if (!now)
+			now = now_us();
+		e.input_event_sec = now / 1000000;
+		e.input_event_usec = now % 1000000;
+
+		if (e.type == EV_KEY) {
+			if (e.code >= KEY_CNT || !test_bit(e.code, key_mask))
+				continue;
+		} else if (e.type != EV_SYN) {
+			continue;
+		}
+		ev[got++] = e;
+	}
+
+	/* Wake up once more to report the end of the stream */
+	if (got && r->eof && r->timer >= 0)
+		replay_arm(r, 0);
+	if (got)
+		return got;
+	return r->eof ? 0 : -1;
+}
+
+/* Decodes the next event of a replayed stream without consuming it, returns
+ * its length in the buffer or 0 if it is not complete yet. Name records of the
+ * event log are skipped */
+size_t replay_next (struct replay *r, struct input_event *e)
+{
+	const unsigned char *p, *end;
+	unsigned long long tag, v[4];
+	size_t len, n;
+
+	p = (unsigned char *) r->buf + r->start;
+	end = (unsigned char *) r->buf + r->end;
+	if (r->format == REPLAY_UNKNOWN) {
+		if (end - p < 8 && !r->eof)
+			return 0;
+		if (end - p >= 8 && !memcmp(p, RECORD_MAGIC, 4)) {
+			if (p[4] != RECORD_VERSION)
+				die("Unsupported event log version %u", p[4]);
+			r->format = REPLAY_LOG;
+			r->start += 8;
+			p += 8;
+		} else {
+			r->format = REPLAY_RAW;
+		}
+	}
+
+	if (r->format == REPLAY_RAW) {
+		if ((size_t) (end - p) < sizeof(*e))
+			return 0;
+		memcpy(e, p, sizeof(*e));
+		return sizeof(*e);
+	}
+
+	for (;;) {
+		if (!(len = varint_get(p, end, &tag)))
+			return 0;
+		if (tag & 1) {
+			if (!(n = varint_get(p + len, end, &v[0])) ||
+			    (size_t) (end - p) < len + n + v[0])
+				return 0;
+			len += n + v[0];
+			p += len;
+			r->start += len;
+			continue;
+		}
+		for (int i = 0; i < 4; i++) {
+			if (!(n = varint_get(p + len, end, &v[i])))
+				return 0;
+			len += n;
+		}
+		break;
+	}
+
+	/* Timestamps are relative to the last event consumed */
+	v[0] = r->time + (long long) (v[0] >> 1 ^ -(v[0] & 1));
+	e->input_event_sec = v[0] / 1000000;
+	e->input_event_usec = v[0] % 1000000;
+	e->type = v[1];
+	e->code = v[2];
+	e->value = (int) (v[3] >> 1 ^ -(v[3] & 1));
+	return len;
+}
+
+/* Recorded streams have no kernel mask, replay_read() applies key_mask */
+void replay_set_mask (struct device *dev)
+{
+	(void) dev;
+}
+
+void replay_close (struct device *dev)
+{
+	struct replay *r = dev->replay;
+
+	if (r->timer >= 0)
+		close(r->timer);
+	close(r->in);
+	free(r);
+}
+
+struct device * device_find (const char *name)
+{
+	struct device *dev;
+	for (dev = device_list; dev; dev = dev->next)
+		if (!strcmp(dev->name, name))
+			break;
+	return dev;
+}
+
+/* Checks the open devices against the reloaded config: the ones that can not
+ * emit any bound key anymore are closed, the others get the new event mask,
+ * then the devices that were previously ignored are checked again */
+void devices_reload (void)
+{
+	struct device *dev, *next;
+
+	for (dev = device_list; dev; dev = next) {
+		next = dev->next;
+		if (key_bits_intersect(dev->key_b, hotkeys->bound_keys)) {
+			device_set_mask(dev);
+		} else {
+			if (vflag)
+				printf(yellow("Device %s has no bound keys\n"), dev->name);
+			device_close(dev);
+		}
+	}
+	if (!replay_file)
+		update_descriptors_list();
+}
+
+/* Removes a device from the epoll set and the device list and closes it */
+void device_close (struct device *dev)
+{
+	struct device **tmp;
+
+	for (tmp = &device_list; *tmp && *tmp != dev; tmp = &(*tmp)->next);
+	if (!*tmp)
+		return;
+	*tmp = dev->next;
+
+	/* Closing the descriptor is enough to remove it from the epoll set but
+	 * be explicit about it, as the descriptor might have been duplicated */
+	epoll_ctl(ev_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+	dev->source->close(dev);
+	if (vflag)
+		printf(yellow("Removed device %s\n"), dev->name);
+	free(dev);
+}
+
+int prepare_epoll (void)
+{
+ 	int ev_fd = epoll_create(1);
+	struct epoll_event epoll_read_ev;
+ 	epoll_read_ev.events = EPOLLIN;
+ 	if (ev_fd < 0)
+ 		die("epoll_create failed in prepare_epoll:");
+	/* Devices are identified by their entry in the device list, other
+	 * descriptors by the address of the variable holding them */
+	epoll_read_ev.data.ptr = &event_watcher;
+ 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, event_watcher, &epoll_read_ev) < 0)
+ 		die("Could not add file descriptor to the epoll list:");
+	epoll_read_ev.data.ptr = &settle_timer;
+ 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, settle_timer, &epoll_read_ev) < 0)
+ 		die("Could not add file descriptor to the epoll list:");
+	epoll_read_ev.data.ptr = &reload_timer;
+ 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, reload_timer, &epoll_read_ev) < 0)
+ 		die("Could not add file descriptor to the epoll list:");
+	epoll_read_ev.data.ptr = &signal_fd;
+ 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, signal_fd, &epoll_read_ev) < 0)
+ 		die("Could not add file descriptor to the epoll list:");
+	epoll_read_ev.data.ptr = &exec_sock;
+ 	if (epoll_ctl(ev_fd, EPOLL_CTL_ADD, exec_sock, &epoll_read_ev) < 0)
+ 		die("Could not add file descriptor to the epoll list:");
+	return ev_fd;
+}
+
+/* Reads all the pending events of a device in as few reads as possible and
+ * hands them to frame_process() one SYN_REPORT frame at a time, an incomplete
+ * frame at the end of a read is kept in the device and completed by the next
+ * read, even if that comes with a later wakeup. Returns
+ * non zero once the source reached the end of its stream */
+int device_drain (struct device *dev, struct key_state *pb)
+{
+	struct input_event *ev = dev->ev;
+	int start, ev_num;
+	ssize_t got, req;
+
+	for (;;) {
+		req = EV_READ_SIZE - dev->pending;
+		if ((got = dev->source->read(dev, &ev[dev->pending], req)) <= 0)
+			return !got;
+		read_time = now_us();
+		dev->events += got;
+		counters.events += got;
+		if (record)
+			record_events(dev, &ev[dev->pending], got);
+
+		ev_num = dev->pending + got;
+		start = 0;
+		for (int i = dev->pending; i < ev_num; i++) {
+			if (ev[i].type != EV_SYN)
+				continue;
+			switch (ev[i].code) {
+			/* The kernel buffer overflowed, discard everything up to
+			 * the next SYN_REPORT as the evdev documentation says */
+			case SYN_DROPPED:
+				dev->dropped = 1;
+				start = i + 1;
+				break;
+			case SYN_REPORT:
+				frame_time = ev[i].input_event_sec * 1000000LL +
+					ev[i].input_event_usec;
+				if (!dev->dropped)
+					frame_process(&ev[start], i - start, pb);
+				dev->dropped = 0;
+				start = i + 1;
+				break;
+			}
+		}
+		/* Carry the incomplete frame over, unless it alone fills the
+		 * whole buffer, in which case it is dropped */
+		if (!start && ev_num == EV_READ_SIZE)
+			dev->dropped = 1;
+		dev->pending = ev_num - start;
+		if (dev->dropped)
+			dev->pending = 0;
+		memmove(ev, &ev[start], dev->pending * sizeof(struct input_event));
+
+		/* A short read means that the device has been drained */
+		if (got < req)
+			break;
+	}
+	return 0;
+}
+
+/* Applies the key events of a frame to the pressed buffer and, if new keys
+ * were pressed, runs the matcher once for the whole frame */
+void frame_process (struct input_event *ev, int ev_num, struct key_state *pb)
+{
+	int pressed = 0;
+
+	counters.frames++;
+	for (int i = 0; i < ev_num; i++) {
+		/* Ignore touchpad events */
+		if (
+			ev[i].type != EV_KEY ||
+			ev[i].code == BTN_TOUCH ||
+			ev[i].code == BTN_TOOL_FINGER ||
+			ev[i].code == BTN_TOOL_DOUBLETAP ||
+			ev[i].code == BTN_TOOL_TRIPLETAP
+			)
+			continue;
+		switch (ev[i].value) {
+		/* Key released */
+		case 0:
+			key_state_release(pb, ev[i].code);
+			break;
+		/* Key pressed, unless the device mask would have dropped it,
+		 * releases always go through in case key_mask changed */
+		case 1:
+			if (ev[i].code >= KEY_CNT || !test_bit(ev[i].code, key_mask))
+				break;
+			if (!key_state_press(pb, ev[i].code))
+				pressed = 1;
+			break;
+		}
+	}
+
+	/* Compare against the pressed flag and not the buffer size, a frame
+	 * can release a key and press another one */
+	if (!pressed)
+		return;
+
+	if (vflag) {
+		printf("Pressed keys: ");
+		key_state_foreach(k, pb)
+			printf("%s ", code_to_name(k));
+		printf("(%lu syscalls)\n", syscall_count);
+	}
+
+	hotkey_match(pb);
+}
+
+/* Executes the commands of all the hotkeys matching the pressed buffer */
+void hotkey_match (struct key_state *pb)
+{
+	struct hotkey_table *t = hotkeys;
+	unsigned int id;
+
+	if (pb->size > KEY_BUFFER_SIZE || !(t->size_mask & 1 << (pb->size - 1)))
+		return;
+	/* Fuzzy hotkeys, the hash only selects the candidates */
+	if (t->chord_table) {
+		id = t->chord_table[pb->hash & t->chord_table_mask];
+		for (; id != HOTKEY_NONE; id = t->match_next[id]) {
+			counters.probes++;
+			if (t->hash[id] == pb->hash && key_state_compare_fuzzy(pb, &t->kb[id]))
+				exec_command(t, id);
+		}
+	}
+	/* Ordered hotkeys, the trie node was advanced by the key press */
+	if (pb->trie_node != TRIE_DEAD && t->trie_accept) {
+		id = t->trie_accept[pb->trie_node];
+		for (; id != HOTKEY_NONE; id = t->match_next[id]) {
+			counters.probes++;
+			exec_command(t, id);
+		}
+	}
+}
+
+/* Checks if all the keys of a key buffer are pressed (superset query) */
+int key_state_contains (struct key_state *haystack, struct key_buffer *needle)
+{
+	for (unsigned int i = 0; i < needle->size; i++)
+		if (!test_bit(needle->buf[i], haystack->bits))
+			return 0;
+	return 1;
+}
+
+/* Checks if exactly the keys of a key buffer are pressed, in any order */
+int key_state_compare_fuzzy (struct key_state *haystack, struct key_buffer *needle)
+{
+	if (haystack->size != needle->size)
+		return 0;
+	return key_state_contains(haystack, needle);
+}
+
+/* Allocates an empty table for up to cap hotkeys, the table and the hotkey
+ * arrays are a single block, ordered by decreasing alignment. The pool starts
+ * with pool_size bytes and grows as needed. */
+struct hotkey_table * hotkey_table_new (unsigned int cap, size_t pool_size)
+{
+	struct hotkey_table *t;
+	char *p;
+
+	if (!(p = calloc(1, sizeof(struct hotkey_table) + cap * (sizeof(*t->stats) +
+	    sizeof(*t->hash) + sizeof(*t->kb) + sizeof(*t->match_next) +
+	    sizeof(*t->command) + sizeof(*t->msg) + sizeof(*t->msg_len) +
+	    sizeof(*t->flags)))))
+		die("Memory allocation failed in hotkey_table_new():");
+	t = (struct hotkey_table *) p;
+	p += sizeof(struct hotkey_table);
+	t->stats = (struct hotkey_stats *) p;
+	p += cap * sizeof(*t->stats);
+	t->hash = (unsigned long long *) p;
+	p += cap * sizeof(*t->hash);
+	t->kb = (struct key_buffer *) p;
+	p += cap * sizeof(*t->kb);
+	t->match_next = (unsigned int *) p;
+	p += cap * sizeof(*t->match_next);
+	t->command = (unsigned int *) p;
+	p += cap * sizeof(*t->command);
+	t->msg = (unsigned int *) p;
+	p += cap * sizeof(*t->msg);
+	t->msg_len = (unsigned int *) p;
+	p += cap * sizeof(*t->msg_len);
+	t->flags = (unsigned char *) p;
+	t->cap = cap;
+
+	t->pool_size = pool_size ? pool_size : 1;
+	if (!(t->pool = malloc(t->pool_size)))
+		die("Memory allocation failed in hotkey_table_new():");
+	return t;
+}
+
+/* Reserves len bytes in the pool of a table, aligned for an exec_msg, and
+ * returns their offset. The pool may move. */
+size_t hotkey_table_pool_alloc (struct hotkey_table *t, size_t len)
+{
+	size_t off = (t->pool_len + sizeof(long long) - 1) & ~(sizeof(long long) - 1);
+
+	if (off + len > t->pool_size) {
+		while (off + len > t->pool_size)
+			t->pool_size *= 2;
+		if (!(t->pool = realloc(t->pool, t->pool_size)))
+			die("Memory allocation failed in hotkey_table_pool_alloc():");
+	}
+	t->pool_len = off + len;
+	return off;
+}
+
+void hotkey_table_destroy (struct hotkey_table *t)
+{
+	if (!t)
+		return;
+	for (unsigned int id = 0; id < t->num; id++)
+		free(t->stats[id].latency);
+	if (t->map) {
+		munmap(t->map, t->map_len);
+	} else {
+		free(t->pool);
+		free(t->chord_table);
+		free(t->trie_edges);
+		free(t->trie_accept);
+	}
+	free(t);
+}
+
+/* Indexes the fuzzy hotkeys of a table in its chord table, the chord table
+ * is sized to the next power of two of twice the number of fuzzy hotkeys.
+ * Hotkeys with the same chord keep their config order in the bucket. */
+void chord_table_build (struct hotkey_table *t)
+{
+	unsigned long size = 1, count = 0;
+	unsigned int *bucket;
 
-				for (alloc_tmp = 0; bb[alloc_tmp] &&
-				bb[alloc_tmp] != ':' && bb[alloc_tmp] != '\n' &&
-				alloc_tmp < alloc_size; alloc_tmp++);
-
-				if (!bb[alloc_tmp] || alloc_tmp == alloc_size) {
-					strncat(keys, bb, alloc_tmp);
-					bb += alloc_tmp;
-					if (block_state == LAST_BL)
-						die("Keys not finished before end of file");
-					else
-						block_state = NEW_BL;
-					break;
-				} else if (bb[alloc_tmp] == ':') {
-					strncat(keys, bb, alloc_tmp);
-					bb += alloc_tmp + 1;
-					parse_state = GET_CMD;
-					break;
-				} else {
-					die("Error at line %d: "
-					"no command specified, missing ':' after keys",
-					linenum);
-				}
-				break;
-			// Get command
-			case 4:
-				if (!cmd) {
-					if (!(cmd = malloc(alloc_size = (sizeof(char) * 128))))
-						die("malloc for cmd in parse_config_file():");
-					memset(cmd, 0, alloc_size);
-				} else if (alloc_tmp >= alloc_size) {
-					if (!(cmd = realloc(cmd, alloc_size = alloc_size * 2)))
-						die("realloc for cmd in parse_config_file():");
-					memset(&cmd[alloc_size / 2], 0, alloc_size / 2);
-				}
+	for (unsigned int id = 0; id < t->num; id++)
+		count += (t->flags[id] & (HOTKEY_FUZZY | HOTKEY_REMOVED)) == HOTKEY_FUZZY;
+	t->chord_num = count;
+	if (!count)
+		return;
+	while (size < count * 2)
+		size <<= 1;
+	if (!(t->chord_table = malloc(size * sizeof(unsigned int))))
+		die("Memory allocation failed in chord_table_build():");
+	memset(t->chord_table, 0xff, size * sizeof(unsigned int));
+	t->chord_table_mask = size - 1;
+
+	/* Prepending in reverse keeps the config order */
+	for (unsigned int id = t->num; id--;) {
+		if ((t->flags[id] & (HOTKEY_FUZZY | HOTKEY_REMOVED)) != HOTKEY_FUZZY)
+			continue;
+		bucket = &t->chord_table[t->hash[id] & t->chord_table_mask];
+		t->match_next[id] = *bucket;
+		*bucket = id;
+	}
+}
 
-				for (alloc_tmp = 0; bb[alloc_tmp] && bb[alloc_tmp] != '\n' &&
-				alloc_tmp < alloc_size; alloc_tmp++);
-
-				if (!bb[alloc_tmp] || alloc_tmp == alloc_size) {
-					strncat(cmd, bb, alloc_tmp);
-					bb += alloc_tmp;
-					if (block_state == LAST_BL)
-						die("Command not finished before end of file");
-					else
-						block_state = NEW_BL;
-					break;
-				} else {
-					strncat(cmd, bb, alloc_tmp);
-					if (!(bb[alloc_tmp - 1] == '\\'))
-						parse_state = LAST;
-					bb += alloc_tmp + 1;
-					linenum++;
-					break;
-				}
-				break;
-			case 5:
-				if (!keys)
-					die("error");
-				i_tmp = strlen(keys);
-				for (int i = 0; i < i_tmp; i++) {
-					if (isblank(keys[i])) {
-						memmove(&keys[i], &keys[i + 1], --i_tmp);
-						keys[i_tmp] = '\0';
-						}
-				}
-				cp_tmp = strtok(keys, ",");
-				if(!cp_tmp)
-					die("Error at line %d: "
-					"keys not present", linenum - 1);
-
-				do {
-					if (!(us_tmp = key_to_code(cp_tmp))) {
-						die("Error at line %d: "
-						"%s is not a valid key",
-						linenum - 1, cp_tmp);
-					}
-					if (key_buffer_add(&kb, us_tmp))
-						die("Too many keys");
-				} while ((cp_tmp = strtok(NULL, ",")));
-
-				cp_tmp = cmd;
-				while (isblank(*cp_tmp))
-					cp_tmp++;
-				if (*cp_tmp == '\0')
-					die("Error at line %d: "
-					"command not present", linenum - 1);
-
-				hotkey_list_add(hotkey_list, &kb, cp_tmp, fuzzy);
-				hotkey_size_mask |= 1 << (kb.size - 1);
-
-				key_buffer_reset(&kb);
-				free(keys);
-				free(cmd);
-				cp_tmp = keys = cmd = NULL;
-				i_tmp = 0;
-				parse_state = NORM;
-				break;
-			default:
-				die("Unknown state in parse_config_file");
+/* Returns the slot of the edge leaving node parent with key, or the empty
+ * slot where it would be inserted */
+struct trie_edge * trie_slot (const struct hotkey_table *t, unsigned int parent, unsigned short key)
+{
+	unsigned long i = (key_hash(key) ^ parent * 0x9e3779b97f4a7c15ULL) & t->trie_edges_mask;
+	for (; t->trie_edges[i].child != TRIE_ROOT; i = (i + 1) & t->trie_edges_mask)
+		if (t->trie_edges[i].parent == parent && t->trie_edges[i].key == key)
+			break;
+	return &t->trie_edges[i];
+}
+
+/* Returns the node reached from node parent by pressing key, or TRIE_DEAD if
+ * no ordered hotkey continues that way */
+unsigned int trie_child (const struct hotkey_table *t, unsigned int parent, unsigned short key)
+{
+	struct trie_edge *e;
+	if (!t->trie_edges)
+		return TRIE_DEAD;
+	e = trie_slot(t, parent, key);
+	return e->child != TRIE_ROOT ? e->child : TRIE_DEAD;
+}
+
+/* Compiles the ordered hotkeys of a table into its trie, with an edge table of
+ * at least min_size slots. Hotkeys with the same keys keep their config order
+ * in the node */
+void trie_build (struct hotkey_table *t, unsigned long min_size)
+{
+	struct trie_edge *e;
+	struct key_buffer *kb;
+	unsigned long size = 1, keys = 0;
+	unsigned int node;
+
+	for (unsigned int id = 0; id < t->num; id++)
+		if (!(t->flags[id] & (HOTKEY_FUZZY | HOTKEY_REMOVED)))
+			keys += t->kb[id].size;
+	if (!keys)
+		return;
+	/* There are at most as many edges as keys and one more node */
+	while (size < keys * 2 || size < min_size)
+		size <<= 1;
+	if (!(t->trie_edges = calloc(size, sizeof(struct trie_edge))))
+		die("Memory allocation failed in trie_build():");
+	if (!(t->trie_accept = malloc((size / 2 + 1) * sizeof(unsigned int))))
+		die("Memory allocation failed in trie_build():");
+	memset(t->trie_accept, 0xff, (size / 2 + 1) * sizeof(unsigned int));
+	t->trie_edges_mask = size - 1;
+	t->trie_size = 1;
+
+	/* Prepending in reverse keeps the config order */
+	for (unsigned int id = t->num; id--;) {
+		if (t->flags[id] & (HOTKEY_FUZZY | HOTKEY_REMOVED))
+			continue;
+		kb = &t->kb[id];
+		node = TRIE_ROOT;
+		for (unsigned int i = 0; i < kb->size; i++) {
+			e = trie_slot(t, node, kb->buf[i]);
+			if (e->child == TRIE_ROOT) {
+				e->parent = node;
+				e->key = kb->buf[i];
+				e->child = t->trie_size++;
+			}
+			node = e->child;
+		}
+		t->match_next[id] = t->trie_accept[node];
+		t->trie_accept[node] = id;
+	}
+}
+
+/* Appends a fuzzy hotkey to the chord table, which is rebuilt twice as big
+ * once it is half full */
+void chord_table_insert (struct hotkey_table *t, unsigned int id)
+{
+	unsigned int *bucket;
+
+	if (!t->chord_table || (t->chord_num + 1) * 2 > t->chord_table_mask + 1) {
+		free(t->chord_table);
+		t->chord_table = NULL;
+		chord_table_build(t);
+		return;
+	}
+	for (bucket = &t->chord_table[t->hash[id] & t->chord_table_mask];
+	     *bucket != HOTKEY_NONE; bucket = &t->match_next[*bucket]);
+	*bucket = id;
+	t->match_next[id] = HOTKEY_NONE;
+	t->chord_num++;
+}
+
+/* Adds the keys of an ordered hotkey to the trie and appends it to its node.
+ * The trie is rebuilt twice as big, renumbering the nodes, once the edges would
+ * not fit anymore */
+void trie_insert (struct hotkey_table *t, unsigned int id)
+{
+	struct key_buffer *kb = &t->kb[id];
+	struct trie_edge *e;
+	unsigned int node = TRIE_ROOT, missing = 0, *accept;
+
+	for (unsigned int i = 0; i < kb->size && t->trie_edges; i++) {
+		if ((node = trie_child(t, node, kb->buf[i])) == TRIE_DEAD) {
+			missing = kb->size - i;
+			break;
+		}
+	}
+	if (!t->trie_edges || (t->trie_size - 1 + missing) * 2 > t->trie_edges_mask + 1) {
+		unsigned long size = t->trie_edges ? (t->trie_edges_mask + 1) * 2 : 0;
+		free(t->trie_edges);
+		free(t->trie_accept);
+		t->trie_edges = NULL;
+		t->trie_accept = NULL;
+		trie_build(t, size);
+		return;
+	}
+
+	node = TRIE_ROOT;
+	for (unsigned int i = 0; i < kb->size; i++) {
+		e = trie_slot(t, node, kb->buf[i]);
+		if (e->child == TRIE_ROOT) {
+			e->parent = node;
+			e->key = kb->buf[i];
+			e->child = t->trie_size++;
+		}
+		node = e->child;
+	}
+	for (accept = &t->trie_accept[node]; *accept != HOTKEY_NONE;
+	     accept = &t->match_next[*accept]);
+	*accept = id;
+	t->match_next[id] = HOTKEY_NONE;
+}
+
+/* Returns the trie node reached by the keys of an ordered hotkey */
+unsigned int trie_find (const struct hotkey_table *t, const struct key_buffer *kb)
+{
+	unsigned int node = TRIE_ROOT;
+
+	for (unsigned int i = 0; i < kb->size && node != TRIE_DEAD; i++)
+		node = trie_child(t, node, kb->buf[i]);
+	return node;
+}
+
+/* Adds a hotkey to the table in use and to its indexes, without recompiling
+ * the others. Returns its id or -1 if the command is not valid */
+int hotkey_insert (struct key_buffer *kb, char *cmd, int fuzzy)
+{
+	struct hotkey_table *t;
+	unsigned char bound[KEY_CNT / 8 + 1];
+	unsigned int id;
+
+	/* A table loaded from the cache has no room to grow */
+	if (hotkeys->map || hotkeys->num == hotkeys->cap)
+		hotkey_table_grow();
+	t = hotkeys;
+	if (hotkey_table_add(t, kb, cmd, fuzzy))
+		return -1;
+	id = t->num - 1;
+	t->size_mask |= 1 << (kb->size - 1);
+	if (fuzzy)
+		chord_table_insert(t, id);
+	else
+		trie_insert(t, id);
+
+	memcpy(bound, t->bound_keys, sizeof(bound));
+	for (unsigned int i = 0; i < kb->size; i++)
+		set_bit(kb->buf[i], t->bound_keys);
+	if (memcmp(bound, t->bound_keys, sizeof(bound)))
+		key_mask_update();
+	hotkeys_dirty = 1;
+	return id;
+}
+
+/* Unlinks a hotkey from the indexes of the table in use, its id is not reused.
+ * The keys it used stay bound. Returns non zero if there is no such hotkey */
+int hotkey_remove (unsigned int id)
+{
+	struct hotkey_table *t = hotkeys;
+	unsigned int *link, node;
+
+	if (id >= t->num || t->flags[id] & HOTKEY_REMOVED)
+		return 1;
+	if (t->flags[id] & HOTKEY_FUZZY) {
+		link = &t->chord_table[t->hash[id] & t->chord_table_mask];
+		t->chord_num--;
+	} else {
+		node = trie_find(t, &t->kb[id]);
+		link = &t->trie_accept[node];
+	}
+	for (; *link != id; link = &t->match_next[*link]);
+	*link = t->match_next[id];
+	t->flags[id] |= HOTKEY_REMOVED;
+	return 0;
+}
+
+/* Copies the table in use to a new one with room for twice as many hotkeys,
+ * keeping the ids and the stats */
+void hotkey_table_grow (void)
+{
+	struct hotkey_table *old = hotkeys, *t;
+	unsigned int n = old->num;
+
+	t = hotkey_table_new(n * 2 + 8, old->pool_len * 2);
+	memcpy(t->stats, old->stats, n * sizeof(*t->stats));
+	memcpy(t->hash, old->hash, n * sizeof(*t->hash));
+	memcpy(t->kb, old->kb, n * sizeof(*t->kb));
+	memcpy(t->command, old->command, n * sizeof(*t->command));
+	memcpy(t->msg, old->msg, n * sizeof(*t->msg));
+	memcpy(t->msg_len, old->msg_len, n * sizeof(*t->msg_len));
+	memcpy(t->flags, old->flags, n * sizeof(*t->flags));
+	memcpy(t->pool, old->pool, old->pool_len);
+	memcpy(t->bound_keys, old->bound_keys, sizeof(t->bound_keys));
+	t->pool_len = old->pool_len;
+	t->num = n;
+	t->gen = old->gen;
+	t->size_mask = old->size_mask;
+	for (unsigned int id = 0; id < n; id++)
+		old->stats[id].latency = NULL;
+	chord_table_build(t);
+	trie_build(t, 0);
+
+	hotkeys = t;
+	hotkeys_dirty = 1;
+	hotkey_table_destroy(old);
+}
+
+/* Appends a hotkey to a table expanding its command, unless it starts with
+ * '@' which asks for the command to be expanded on every trigger, and prepares
+ * the executor message in the pool. Command substitution is never run here as
+ * it would freeze its output and stall the event loop, commands that use it are
+ * expanded on every trigger like the '@' ones. Returns non zero if the command
+ * could not be expanded or is too long, or if the table is full. */
+int hotkey_table_add (struct hotkey_table *t, struct key_buffer *kb, char *cmd, int f)
+{
+	int size, late, err;
+	wordexp_t result;
+	struct exec_msg *msg;
+	unsigned int id = t->num;
+	size_t len = sizeof(struct exec_msg), off;
+	char *words;
+
+	if (id >= t->cap)
+		return 1;
+	if ((late = *cmd == '@'))
+		cmd++;
+	if (!(size = strlen(cmd)))
+		return 1;
+
+	if (!late && (err = wordexp(cmd, &result, WRDE_NOCMD)) == WRDE_CMDSUB)
+		late = 1;
+	if (late) {
+		len += size + 1;
+	} else {
+		if (err || !result.we_wordc) {
+			/* If the error was WRDE_NOSPACE,
+			 * then perhaps part of the result was allocated */
+			if (!err || err == WRDE_NOSPACE)
+				wordfree(&result);
+			return 1;
+		}
+		for (size_t i = 0; i < result.we_wordc; i++)
+			len += strlen(result.we_wordv[i]) + 1;
+	}
+	if (len > EXEC_MSG_MAX) {
+		if (!late)
+			wordfree(&result);
+		return 1;
+	}
+
+	t->command[id] = hotkey_table_pool_alloc(t, size + 1);
+	strcpy(t->pool + t->command[id], cmd);
+	t->msg[id] = off = hotkey_table_pool_alloc(t, len);
+	t->msg_len[id] = len;
+	msg = (struct exec_msg *) (t->pool + off);
+	msg->id = id;
+	msg->gen = t->gen;
+	msg->late = late;
+	msg->time = 0;
+	words = t->pool + off + sizeof(struct exec_msg);
+	if (late) {
+		strcpy(words, cmd);
+	} else {
+		for (size_t i = 0; i < result.we_wordc; i++) {
+			strcpy(words, result.we_wordv[i]);
+			words += strlen(words) + 1;
+		}
+		wordfree(&result);
+	}
+
+	t->kb[id] = *kb;
+	t->hash[id] = 0;
+	for (unsigned int i = 0; i < kb->size; i++)
+		t->hash[id] ^= key_hash(kb->buf[i]);
+	t->match_next[id] = HOTKEY_NONE;
+	t->flags[id] = (f ? HOTKEY_FUZZY : 0) | (late ? HOTKEY_LATE : 0);
+	t->num++;
+	return 0;
+}
+
+/* Opens the config file given with -c or the first one found in config_paths
+ * and remembers its path. Returns -1 on error. */
+int config_open (void)
+{
+	wordexp_t result = {0};
+	int fd = -1;
+
+	for (int i = 0; i < array_size_const(config_paths); i++) {
+		const char *path = ext_config_file ? ext_config_file : config_paths[i];
+		switch (wordexp(path, &result, 0)) {
+		case 0:
+			break;
+		case WRDE_NOSPACE:
+			/* If the error was WRDE_NOSPACE,
+			 * then perhaps part of the result was allocated */
+			wordfree (&result);
+			parse_error("Not enough space:");
+			return -1;
+		default:
+			parse_error("Path not valid:");
+			return -1;
+		}
+
+		fd = result.we_wordc ? open(result.we_wordv[0], O_RDONLY | O_CLOEXEC) : -1;
+		if (fd >= 0)
+			config_path_set(result.we_wordv[0]);
+		wordfree(&result);
+		if (fd >= 0)
+			return fd;
+		if (ext_config_file) {
+			parse_error("Error opening config file:");
+			return -1;
+		}
+		if (vflag)
+			printf(yellow("config file not found at %s\n"), config_paths[i]);
+	}
+	parse_error("Could not open any config files, check the log for more details");
+	return -1;
+}
+
+/* Parses the comma separated key names between p and end into a key buffer,
+ * blanks are ignored. Returns NULL or the error, so that the config parser and
+ * the control socket can each report it their own way. */
+const char * parse_keys (const char *p, const char *end, struct key_buffer *kb)
+{
+	static char err[64];
+	char name[32];
+	unsigned short code;
+	size_t len;
+
+	key_buffer_reset(kb);
+	while (p < end) {
+		for (len = 0; p < end && *p != ','; p++) {
+			if (isblank(*p))
+				continue;
+			if (len < sizeof(name) - 1)
+				name[len] = *p;
+			len++;
+		}
+		p++;
+		if (!len)
+			continue;
+		if (len >= sizeof(name))
+			return "key name too long";
+		name[len] = '\0';
+		if (!(code = key_to_code(name))) {
+			snprintf(err, sizeof(err), "%s is not a valid key", name);
+			return err;
+		}
+		if (key_buffer_add(kb, code))
+			return "too many keys";
+	}
+	if (!kb->size)
+		return "keys not present";
+	return NULL;
+}
+
+/* Compiles the config file into a new hotkey table, on error it is reported
+ * and NULL is returned so that the caller can keep using the current table.
+ * With -C the table is loaded from the cache if it was compiled from the
+ * same config, otherwise the cache is written again. */
+struct hotkey_table * parse_config_file (void)
+{
+	struct hotkey_table *t = NULL;
+	struct stat st;
+	const char *map = NULL;
+	unsigned long long sum = 0;
+	size_t size;
+	int fd;
+
+	if ((fd = config_open()) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		parse_error("Could not stat the config file:");
+		close(fd);
+		return NULL;
+	}
+	size = st.st_size;
+	if (size && (map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		parse_error("Could not map the config file:");
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	if (cache_file) {
+		sum = config_checksum(map, size);
+		if ((t = hkdc_load(cache_file, sum)) && vflag)
+			printf(green("Loaded the compiled config from %s\n"), cache_file);
+	}
+	if (!t && (t = parse_config(map, size)) && cache_file &&
+	    hkdc_write(t, cache_file, sum))
+		fprintf(stderr, red("Could not write %s: %s\n"), cache_file, strerror(errno));
+	if (map)
+		munmap((void *) map, size);
+	return t;
+}
+
+/* Parses the config file mapped at map in a single pass, a line at a time,
+ * and compiles it into a new hotkey table. Returns NULL on error. */
+struct hotkey_table * parse_config (const char *map, size_t size)
+{
+	struct hotkey_table *t = NULL;
+	struct key_buffer kb;
+	const char *p, *eol, *end, *colon, *err;
+	char *cmd = NULL, *c;
+	int fuzzy, linenum, line;
+	unsigned int lines;
+
+	/* A command is never longer than the file */
+	if (!(cmd = malloc(size + 1)))
+		die("Memory allocation failed in parse_config_file():");
+	/* There can not be more hotkeys than lines, the pool fits all the
+	 * commands unless their expansion makes them longer */
+	end = map + size;
+	for (p = map, lines = 1; p < end && (p = memchr(p, '\n', end - p)); p++)
+		lines++;
+	t = hotkey_table_new(lines, 2 * size);
+	t->gen = ++config_gen;
+
+	for (p = map, linenum = 1; p < end; p = eol + 1, linenum++) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		while (p < eol && isblank(*p))
+			p++;
+		if (p == eol || *p == '#')
+			continue;
+
+		line = linenum;
+		switch (*p++) {
+		case '-':
+			fuzzy = 0;
+			break;
+		case '*':
+			fuzzy = 1;
+			break;
+		default:
+			parse_error("Error at line %d: "
+				"hotkey definition must start with '-' or '*'", line);
+			goto fail;
+		}
+
+		if (!(colon = memchr(p, ':', eol - p))) {
+			parse_error("Error at line %d: "
+				"no command specified, missing ':' after keys", line);
+			goto fail;
+		}
+		if ((err = parse_keys(p, colon, &kb))) {
+			parse_error("Error at line %d: %s", line, err);
+			goto fail;
+		}
+
+		/* The command goes on in the next line if this one ends with a
+		 * backslash, the backslash and the newline are dropped */
+		for (p = colon + 1; p < eol && isblank(*p); p++);
+		for (c = cmd;; p = eol + 1, linenum++) {
+			if (p > eol && !(eol = memchr(p, '\n', end - p)))
+				eol = end;
+			memcpy(c, p, eol - p);
+			c += eol - p;
+			if (c == cmd || c[-1] != '\\' || eol == end)
 				break;
+			c--;
+		}
+		while (c > cmd && isspace(c[-1]))
+			c--;
+		*c = '\0';
+		if (!*cmd) {
+			parse_error("Error at line %d: command not present", line);
+			goto fail;
+		}
+
+		if (hotkey_table_add(t, &kb, cmd, fuzzy)) {
+			parse_error("Error at line %d: "
+				"command %s is not valid", line, cmd);
+			goto fail;
+		}
+		t->size_mask |= 1 << (kb.size - 1);
+	}
+	free(cmd);
+
+	chord_table_build(t);
+	trie_build(t, 0);
+	for (unsigned int id = 0; id < t->num; id++)
+		for (unsigned int i = 0; i < t->kb[id].size; i++)
+			set_bit(t->kb[id].buf[i], t->bound_keys);
+	return t;
+
+fail:
+	free(cmd);
+	hotkey_table_destroy(t);
+	return NULL;
+}
+
+/* Adds the name and the value of an environment variable to a FNV-1a hash,
+ * an unset variable only adds its name */
+unsigned long long config_checksum_var (unsigned long long h, const char *name)
+{
+	const char *value = getenv(name);
+
+	for (const char *c = name; *c; c++)
+		h = (h ^ (unsigned char) *c) * 0x100000001b3ULL;
+	h = (h ^ (unsigned char) (value ? '=' : '\0')) * 0x100000001b3ULL;
+	for (const char *c = value ? value : ""; *c; c++)
+		h = (h ^ (unsigned char) *c) * 0x100000001b3ULL;
+	return h;
+}
+
+/* FNV-1a hash of the config file and of the environment variables the
+ * expansion of the commands depends on: every $NAME or ${NAME} in the file,
+ * HOME for the tilde expansion and IFS for the field splitting. Variables the
+ * commands do not reference, like PWD or SHLVL, do not change the checksum. */
+unsigned long long config_checksum (const char *buf, size_t len)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	char name[256];
+	size_t n;
+
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (unsigned char) buf[i]) * 0x100000001b3ULL;
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] != '$')
+			continue;
+		if (i + 1 < len && buf[i + 1] == '{')
+			i++;
+		for (n = 0; i + 1 < len && n < sizeof(name) - 1 &&
+		     (isalnum((unsigned char) buf[i + 1]) || buf[i + 1] == '_'); i++)
+			name[n++] = buf[i + 1];
+		name[n] = '\0';
+		if (n)
+			h = config_checksum_var(h, name);
+	}
+	h = config_checksum_var(h, "HOME");
+	return config_checksum_var(h, "IFS");
+}
+
+/* Writes a section of the compiled config cache padded to 8 bytes */
+int hkdc_write_section (FILE *f, const void *data, size_t len)
+{
+	static const char pad[8];
+	if (len && fwrite(data, len, 1, f) != 1)
+		return 1;
+	if (len % 8 && fwrite(pad, 8 - len % 8, 1, f) != 1)
+		return 1;
+	return 0;
+}
+
+/* Returns the section of len bytes at *off in the compiled config cache and
+ * advances *off, or NULL if the file is too short */
+void * hkdc_section (char *map, size_t map_len, size_t *off, size_t len)
+{
+	void *p = map + *off;
+	if (len > map_len - *off)
+		return NULL;
+	*off += (len + 7) & ~(size_t) 7;
+	if (*off > map_len)
+		*off = map_len;
+	return p;
+}
+
+/* Writes the compiled table to the cache file, through a temporary file so
+ * that a running hkd never maps a partially written cache. The temporary file
+ * gets a fresh name like the stats file. Returns non zero on error. */
+int hkdc_write (const struct hotkey_table *t, const char *path, unsigned long long checksum)
+{
+	struct hkdc_header h = {0};
+	char tmp[PATH_MAX];
+	FILE *f;
+	int err, fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int) sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return 1;
+	}
+	h.magic = HKDC_MAGIC;
+	h.version = HKDC_VERSION;
+	h.key_cnt = KEY_CNT;
+	h.header_size = sizeof(h);
+	h.checksum = checksum;
+	h.num = t->num;
+	h.size_mask = t->size_mask;
+	h.chord_table_size = t->chord_table ? t->chord_table_mask + 1 : 0;
+	h.trie_edges_size = t->trie_edges ? t->trie_edges_mask + 1 : 0;
+	h.trie_size = t->trie_accept ? t->trie_size : 0;
+	h.pool_len = t->pool_len;
+	memcpy(h.bound_keys, t->bound_keys, sizeof(h.bound_keys));
+
+	if ((fd = mkstemp(tmp)) < 0)
+		return 1;
+	if (fchmod(fd, 0644) < 0 || !(f = fdopen(fd, "w"))) {
+		err = errno;
+		close(fd);
+		unlink(tmp);
+		errno = err;
+		return 1;
+	}
+	err = hkdc_write_section(f, &h, sizeof(h)) ||
+		hkdc_write_section(f, t->hash, t->num * sizeof(*t->hash)) ||
+		hkdc_write_section(f, t->kb, t->num * sizeof(*t->kb)) ||
+		hkdc_write_section(f, t->match_next, t->num * sizeof(*t->match_next)) ||
+		hkdc_write_section(f, t->command, t->num * sizeof(*t->command)) ||
+		hkdc_write_section(f, t->msg, t->num * sizeof(*t->msg)) ||
+		hkdc_write_section(f, t->msg_len, t->num * sizeof(*t->msg_len)) ||
+		hkdc_write_section(f, t->flags, t->num * sizeof(*t->flags)) ||
+		hkdc_write_section(f, t->pool, t->pool_len) ||
+		hkdc_write_section(f, t->chord_table, h.chord_table_size * sizeof(*t->chord_table)) ||
+		hkdc_write_section(f, t->trie_edges, h.trie_edges_size * sizeof(*t->trie_edges)) ||
+		hkdc_write_section(f, t->trie_accept, h.trie_size * sizeof(*t->trie_accept));
+	if (fclose(f) || err || rename(tmp, path)) {
+		err = errno;
+		unlink(tmp);
+		errno = err;
+		return 1;
+	}
+	return 0;
+}
+
+/* Maps the compiled config cache and, if it was compiled from a config with
+ * the given checksum by a compatible build, returns a table pointing into it.
+ * Nothing is parsed, only the executor messages are updated with the new
+ * config generation. Returns NULL if the cache can not be used. */
+struct hotkey_table * hkdc_load (const char *path, unsigned long long checksum)
+{
+	struct hotkey_table *t;
+	struct hkdc_header *h;
+	struct stat st;
+	size_t off = 0;
+	char *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct hkdc_header)) {
+		close(fd);
+		return NULL;
+	}
+	/* Private writable mapping, the messages are updated in place */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	h = (struct hkdc_header *) map;
+	if (h->magic != HKDC_MAGIC || h->version != HKDC_VERSION ||
+	    h->key_cnt != KEY_CNT || h->header_size != sizeof(struct hkdc_header) ||
+	    h->checksum != checksum || h->num >= UINT_MAX ||
+	    h->pool_len > (size_t) st.st_size ||
+	    h->chord_table_size > (size_t) st.st_size ||
+	    h->trie_edges_size > (size_t) st.st_size ||
+	    h->trie_size > (size_t) st.st_size) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	if (!(t = calloc(1, sizeof(struct hotkey_table) + h->num * sizeof(struct hotkey_stats))))
+		die("Memory allocation failed in hkdc_load():");
+	t->stats = (struct hotkey_stats *) (t + 1);
+	t->map = map;
+	t->map_len = st.st_size;
+	t->num = t->cap = h->num;
+	t->size_mask = h->size_mask;
+	t->pool_len = t->pool_size = h->pool_len;
+	t->trie_size = h->trie_size;
+	t->chord_table_mask = h->chord_table_size ? h->chord_table_size - 1 : 0;
+	t->trie_edges_mask = h->trie_edges_size ? h->trie_edges_size - 1 : 0;
+	memcpy(t->bound_keys, h->bound_keys, sizeof(t->bound_keys));
+
+	hkdc_section(map, t->map_len, &off, sizeof(struct hkdc_header));
+	if (!(t->hash = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->hash))) ||
+	    !(t->kb = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->kb))) ||
+	    !(t->match_next = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->match_next))) ||
+	    !(t->command = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->command))) ||
+	    !(t->msg = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->msg))) ||
+	    !(t->msg_len = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->msg_len))) ||
+	    !(t->flags = hkdc_section(map, t->map_len, &off, t->num * sizeof(*t->flags))) ||
+	    !(t->pool = hkdc_section(map, t->map_len, &off, t->pool_len)) ||
+	    !(t->chord_table = hkdc_section(map, t->map_len, &off,
+		h->chord_table_size * sizeof(*t->chord_table))) ||
+	    !(t->trie_edges = hkdc_section(map, t->map_len, &off,
+		h->trie_edges_size * sizeof(*t->trie_edges))) ||
+	    !(t->trie_accept = hkdc_section(map, t->map_len, &off,
+		h->trie_size * sizeof(*t->trie_accept)))) {
+		hotkey_table_destroy(t);
+		return NULL;
+	}
+	if (!h->chord_table_size)
+		t->chord_table = NULL;
+	if (!h->trie_edges_size)
+		t->trie_edges = NULL;
+	if (!h->trie_size)
+		t->trie_accept = NULL;
+
+	if (hkdc_check(t)) {
+		hotkey_table_destroy(t);
+		return NULL;
+	}
+
+	t->gen = ++config_gen;
+	for (unsigned int id = 0; id < t->num; id++) {
+		((struct exec_msg *) (t->pool + t->msg[id]))->gen = t->gen;
+		t->chord_num += (t->flags[id] & HOTKEY_FUZZY) != 0;
+	}
+	return t;
+}
+
+/* Checks that every offset and index in a table loaded from the compiled
+ * config cache stays inside its array, so that a damaged cache can not make
+ * the matcher read out of bounds or loop forever. The match lists are built
+ * in config order, so a valid next hotkey always has a greater id. Returns
+ * non zero if the table is not valid. */
+int hkdc_check (const struct hotkey_table *t)
+{
+	unsigned long edges = 0;
+
+	if ((t->chord_table && t->chord_table_mask & (t->chord_table_mask + 1)) ||
+	    (t->trie_edges && t->trie_edges_mask & (t->trie_edges_mask + 1)) ||
+	    !t->trie_edges != !t->trie_accept)
+		return 1;
+	for (unsigned int id = 0; id < t->num; id++) {
+		if (t->msg[id] % sizeof(long long) ||
+		    t->msg[id] + (size_t) t->msg_len[id] > t->pool_len ||
+		    t->msg_len[id] <= sizeof(struct exec_msg) ||
+		    t->command[id] >= t->pool_len ||
+		    !memchr(t->pool + t->command[id], '\0', t->pool_len - t->command[id]) ||
+		    (t->match_next[id] != HOTKEY_NONE &&
+		    (t->match_next[id] <= id || t->match_next[id] >= t->num)) ||
+		    t->kb[id].size > KEY_BUFFER_SIZE)
+			return 1;
+		for (unsigned int i = 0; i < t->kb[id].size; i++)
+			if (t->kb[id].buf[i] >= KEY_CNT)
+				return 1;
+	}
+	for (unsigned long i = 0; t->chord_table && i <= t->chord_table_mask; i++)
+		if (t->chord_table[i] != HOTKEY_NONE && t->chord_table[i] >= t->num)
+			return 1;
+	for (unsigned int node = 0; node < t->trie_size; node++)
+		if (t->trie_accept[node] != HOTKEY_NONE && t->trie_accept[node] >= t->num)
+			return 1;
+	for (unsigned long i = 0; t->trie_edges && i <= t->trie_edges_mask; i++) {
+		if (t->trie_edges[i].child == TRIE_ROOT)
+			continue;
+		if (t->trie_edges[i].child >= t->trie_size ||
+		    t->trie_edges[i].parent >= t->trie_size ||
+		    t->trie_edges[i].key >= KEY_CNT)
+			return 1;
+		edges++;
+	}
+	/* A probe only ends on an empty slot */
+	if (t->trie_edges && edges > t->trie_edges_mask)
+		return 1;
+	return 0;
+}
+
+/* Loads the config file and applies the hotkeys that changed to the table in
+ * use, unless nothing changed. The table is only swapped for the new one if
+ * the removed hotkeys would outnumber the live ones or if a hotkey could not be
+ * applied. The pressed keys are kept and resynced by the main loop, the
+ * devices are only updated if the bound keys changed. Returns non zero and
+ * keeps the current table if the config is not valid. */
+int config_load (void)
+{
+	struct hotkey_table *t, *old = hotkeys;
+	unsigned int added = 0, removed = 0, changed = 0, dead = 0, *same;
+	long long start = now_us();
+	int patch;
+
+	if (!(t = parse_config_file())) {
+		if (old) {
+			counters.reload_failures++;
+			fprintf(stderr, red("Keeping the current config\n"));
+		}
+		return 1;
+	}
+	if (event_watcher >= 0)
+		config_watch();
+	if (!old) {
+		hotkeys = t;
+		key_mask_update();
+		if (vflag)
+			printf(green("Loaded %u hotkeys\n"), t->num);
+		return 0;
+	}
+
+	counters.reloads++;
+	if (!(same = malloc((t->num + 1) * sizeof(unsigned int))))
+		die("Memory allocation failed in config_load():");
+	if (!hotkey_table_diff(old, t, same, &added, &removed, &changed)) {
+		free(same);
+		hotkey_table_destroy(t);
+		counters.reload_us = now_us() - start;
+		counters.reload_total_us += counters.reload_us;
+		if (vflag)
+			printf("Config unchanged, checked in %lld us\n", counters.reload_us);
+		return 0;
+	}
+
+	for (unsigned int id = 0; id < old->num; id++)
+		dead += (old->flags[id] & HOTKEY_REMOVED) != 0;
+	patch = dead + removed + changed <= t->num;
+	if (patch && hotkey_table_patch(t, same)) {
+		/* The table in use is half patched, the new one is whole */
+		counters.reload_failures++;
+		patch = 0;
+	}
+	if (patch) {
+		hotkey_table_destroy(t);
+	} else {
+		/* Unchanged hotkeys keep their stats, moved only now that the
+		 * new table replaces the old one. Patching may have grown the
+		 * table in use, the ids stay the same */
+		old = hotkeys;
+		for (unsigned int id = 0; id < t->num; id++) {
+			if (same[id] == HOTKEY_NONE)
+				continue;
+			t->stats[id] = old->stats[same[id]];
+			old->stats[same[id]].latency = NULL;
+		}
+		hotkeys = t;
+		hotkeys_dirty = 1;
+		if (memcmp(old->bound_keys, t->bound_keys, sizeof(t->bound_keys)))
+			key_mask_update();
+		hotkey_table_destroy(old);
+	}
+	free(same);
+	counters.reload_us = now_us() - start;
+	counters.reload_total_us += counters.reload_us;
+	if (vflag)
+		printf(green("Config reloaded in %lld us: %u added, %u removed, %u changed\n"),
+			counters.reload_us, added, removed, changed);
+	return 0;
+}
+
+/* Applies a reloaded table to the table in use, given the old id of each
+ * unchanged hotkey: the other old hotkeys are removed and the added or changed
+ * ones are inserted after them, so they run last among the hotkeys with the
+ * same keys. The unchanged hotkeys keep their ids, stats and index entries.
+ * Returns non zero if a hotkey could not be inserted. */
+int hotkey_table_patch (struct hotkey_table *new, unsigned int *same)
+{
+	unsigned char bound[KEY_CNT / 8 + 1], *kept;
+	unsigned int num = hotkeys->num;
+	int err = 0;
+	char *cmd;
+
+	if (!(kept = calloc(num / 8 + 1, 1)))
+		die("Memory allocation failed in hotkey_table_patch():");
+	for (unsigned int id = 0; id < new->num; id++)
+		if (same[id] != HOTKEY_NONE)
+			set_bit(same[id], kept);
+	for (unsigned int id = 0; id < num; id++)
+		if (!test_bit(id, kept))
+			hotkey_remove(id);
+	free(kept);
+
+	/* The inserted keys are already bound, the devices are updated once
+	 * at the end */
+	memcpy(bound, hotkeys->bound_keys, sizeof(bound));
+	memcpy(hotkeys->bound_keys, new->bound_keys, sizeof(bound));
+	for (unsigned int id = 0; id < new->num; id++) {
+		if (same[id] != HOTKEY_NONE)
+			continue;
+		/* Late commands get their marker back */
+		if (!(cmd = malloc(strlen(new->pool + new->command[id]) + 2)))
+			die("Memory allocation failed in hotkey_table_patch():");
+		sprintf(cmd, "%s%s", new->flags[id] & HOTKEY_LATE ? "@" : "",
+			new->pool + new->command[id]);
+		if (hotkey_insert(&new->kb[id], cmd, new->flags[id] & HOTKEY_FUZZY) < 0) {
+			fprintf(stderr, red("Could not apply hotkey %u\n"), id);
+			err = 1;
+		}
+		free(cmd);
+	}
+	hotkeys_dirty = 1;
+	if (memcmp(bound, hotkeys->bound_keys, sizeof(bound)))
+		key_mask_update();
+	return err;
+}
 
+/* Compares a new hotkey table with the old one, a hotkey is unchanged if the
+ * old table has one with the same keys, matching and command, and changed if
+ * only the command differs. same[id] is set to the old id of each unchanged
+ * new hotkey and to HOTKEY_NONE for the others. Returns non zero if the tables
+ * differ. */
+int hotkey_table_diff (struct hotkey_table *old, struct hotkey_table *new, unsigned int *same,
+	unsigned int *added, unsigned int *removed, unsigned int *changed)
+{
+	unsigned char *matched;
+	unsigned int node, cand, other, count = 0;
+
+	*added = *removed = *changed = 0;
+	if (!(matched = calloc(old->num / 8 + 1, 1)))
+		die("Memory allocation failed in hotkey_table_diff():");
+
+	for (unsigned int id = 0; id < new->num; id++) {
+		/* The old indexes give the hotkeys with the same keys */
+		if (new->flags[id] & HOTKEY_FUZZY) {
+			cand = old->chord_table ?
+				old->chord_table[new->hash[id] & old->chord_table_mask] : HOTKEY_NONE;
+		} else {
+			node = TRIE_ROOT;
+			for (unsigned int i = 0; i < new->kb[id].size && node != TRIE_DEAD; i++)
+				node = trie_child(old, node, new->kb[id].buf[i]);
+			cand = node != TRIE_DEAD ? old->trie_accept[node] : HOTKEY_NONE;
+		}
+		same[id] = other = HOTKEY_NONE;
+		for (; cand != HOTKEY_NONE; cand = old->match_next[cand]) {
+			if (test_bit(cand, matched) || ((new->flags[id] & HOTKEY_FUZZY) &&
+			    (old->hash[cand] != new->hash[id] ||
+			    !key_buffer_same_keys(&old->kb[cand], &new->kb[id]))))
+				continue;
+			if (old->flags[cand] == new->flags[id] &&
+			    !strcmp(old->pool + old->command[cand], new->pool + new->command[id])) {
+				same[id] = cand;
+				break;
 			}
+			if (other == HOTKEY_NONE)
+				other = cand;
+		}
+
+		if (same[id] != HOTKEY_NONE) {
+			set_bit(same[id], matched);
+		} else if (other != HOTKEY_NONE) {
+			set_bit(other, matched);
+			(*changed)++;
+		} else {
+			(*added)++;
+			continue;
 		}
+		count++;
+	}
+	free(matched);
+	for (unsigned int id = 0; id < old->num; id++)
+		count += (old->flags[id] & HOTKEY_REMOVED) != 0;
+	*removed = old->num - count;
+	return *added || *removed || *changed;
+}
+
+/* Checks if two key buffers hold the same keys, in any order */
+int key_buffer_same_keys (struct key_buffer *a, struct key_buffer *b)
+{
+	unsigned int j;
+	if (a->size != b->size)
+		return 0;
+	for (unsigned int i = 0; i < a->size; i++) {
+		for (j = 0; j < b->size && b->buf[j] != a->buf[i]; j++);
+		if (j == b->size)
+			return 0;
+	}
+	return 1;
+}
+
+/* Remembers the absolute path of the config file in use, relative paths are
+ * resolved against the working directory */
+void config_path_set (const char *path)
+{
+	if (path[0] != '/' && getcwd(config_path, sizeof(config_path) - 1)) {
+		strcat(config_path, "/");
+		strncat(config_path, path, sizeof(config_path) - strlen(config_path) - 1);
+	} else {
+		strncpy(config_path, path, sizeof(config_path) - 1);
+	}
+}
+
+/* Watches the directory of the config file through the inotify descriptor
+ * also used for EVDEV_ROOT_DIR, as editors and configuration management
+ * tools often replace the file rather than writing to it */
+void config_watch (void)
+{
+	static char watched[PATH_MAX];
+	char dir[PATH_MAX];
+	char *slash;
+
+	strcpy(dir, config_path);
+	if (!(slash = strrchr(dir, '/')))
+		return;
+	if (slash == dir)
+		slash++;
+	*slash = '\0';
+	if (config_wd >= 0 && !strcmp(dir, watched))
+		return;
+	strcpy(watched, dir);
+	if (config_wd >= 0)
+		inotify_rm_watch(event_watcher, config_wd);
+	config_wd = inotify_add_watch(event_watcher, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (config_wd < 0)
+		fprintf(stderr, red("Could not watch %s for changes: %s\n"), dir, strerror(errno));
+}
+
+/* Reloads the config RELOAD_DELAY_MS after the last change, so that a burst
+ * of writes only causes one reload */
+void config_reload_arm (void)
+{
+	struct itimerspec its = {0};
+
+	its.it_value.tv_sec = RELOAD_DELAY_MS / 1000;
+	its.it_value.tv_nsec = (RELOAD_DELAY_MS % 1000) * 1000000;
+	syscall_count++;
+	if (timerfd_settime(reload_timer, 0, &its, NULL) < 0)
+		die("Could not arm the reload timer:");
+}
+
+/* Reports a config error without exiting, a trailing ':' appends the errno
+ * message like die() */
+void parse_error (const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+
+	fputs(ANSI_COLOR_RED, stderr);
+	vfprintf(stderr, fmt, ap);
+	if (fmt[0] && fmt[strlen(fmt) - 1] == ':') {
+		fputc(' ', stderr);
+		perror(NULL);
+	} else {
+		fputc('\n', stderr);
 	}
+	fputs(ANSI_COLOR_RESET, stderr);
+
+	va_end(ap);
+}
+
+/* Hash used by gen_keys.sh to build the key name perfect hash table */
+unsigned long key_name_hash (const char *name, unsigned long seed)
+{
+	unsigned long long h = seed, m = 31 + 2 * seed;
+	for (; *name; name++)
+		h = (h * m + (unsigned char) *name - 31) % 4294967291ULL;
+	return h;
 }
 
 unsigned short key_to_code (char *key)
 {
+	const struct key_name *kn;
+	unsigned long seed;
+
 	for (char *tmp = key; *tmp; tmp++) {
 		if (islower(*tmp))
 			*tmp += 'A' - 'a';
 	}
-	for (int i = 0; i < array_size_const(key_conversion_table); i++) {
-		if (!strcmp(key_conversion_table[i].name, key))
-			return key_conversion_table[i].value;
-	}
+	seed = key_name_seeds[key_name_hash(key, 0) % KEY_NAME_BUCKETS];
+	kn = &key_conversion_table[key_name_hash(key, seed) % KEY_NAME_SLOTS];
+	if (kn->name && !strcmp(kn->name, key))
+		return kn->value;
 	return 0;
 }
 
@@ -819,19 +3835,24 @@ void die(const char *fmt, ...)
 
 const char * code_to_name (unsigned int code)
 {
-	for (int i = 0; i < array_size_const(key_conversion_table); i++) {
-		if (key_conversion_table[i].value == code)
-			return key_conversion_table[i].name;
-	}
+	if (code < KEY_CNT && key_code_names[code])
+		return key_code_names[code];
 	return "Key not recognized";
 }
 
 void usage (void)
 {
-	puts("Usage: hkd [-vdh] [-c file]\n"
+	puts("Usage: hkd [-vdhp] [-c file] [-C file] [-r file] [-R file] [-s dir]\n"
 	     "\t-v        verbose, prints all the key presses and debug information\n"
 	     "\t-d        dump, dumps the hotkey list and exits\n"
 	     "\t-h        prints this help message\n"
-	     "\t-f file   uses the specified file as config\n");
+	     "\t-f file   uses the specified file as config\n"
+	     "\t-C file   loads the compiled config from file, compiling it if\n"
+	     "\t          it is missing or the config changed\n"
+	     "\t-r file   replays the input events recorded in file instead of\n"
+	     "\t          using the input devices, - is the standard input\n"
+	     "\t-p        replays at the recorded speed\n"
+	     "\t-R file   records the events of all the devices to file\n"
+	     "\t-s dir    puts the stats file and the control socket in dir\n");
 	exit(EXIT_SUCCESS);
 }
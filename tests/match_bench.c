@@ -0,0 +1,207 @@
+/* Microbenchmark of the fuzzy matching strategies on a 10k hotkey table:
+ * linear scan with the scalar comparison hkd used to have, the same scan with
+ * SSE2 and AVX2 comparison kernels and the chord hash table hkd uses now.
+ *
+ * gcc -O2 -std=c99 match_bench.c -o match_bench && ./match_bench */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define KEY_BUFFER_SIZE 16
+#define HOTKEYS 10000
+#define LOOKUPS 2000
+#define KEY_MAX_CODE 250
+
+struct key_buffer {
+	unsigned short buf[KEY_BUFFER_SIZE];
+	unsigned int size;
+};
+
+struct hotkey {
+	struct key_buffer kb;
+	unsigned long long hash;
+	struct hotkey *match_next;
+};
+
+struct hotkey hotkeys[HOTKEYS];
+struct key_buffer lookups[LOOKUPS];
+struct hotkey **chord_table;
+unsigned long chord_table_mask;
+
+unsigned long long key_hash (unsigned short key)
+{
+	unsigned long long z = key + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* The comparison hkd used to run against every hotkey */
+int compare_scalar (struct key_buffer *haystack, struct key_buffer *needle)
+{
+	int ff = 0;
+	if (haystack->size != needle->size)
+		return 0;
+	for (int x = needle->size - 1; x >= 0; x--) {
+		for (unsigned int i = 0; i < haystack->size; i++)
+			ff += (needle->buf[x] == haystack->buf[i]);
+		if (!ff)
+			return 0;
+		ff = 0;
+	}
+	return 1;
+}
+
+#ifdef HAVE_X86
+/* Unused slots are zero and KEY_RESERVED is never bound, so the whole 256 bit
+ * buffer can be compared at once */
+int compare_sse2 (struct key_buffer *haystack, struct key_buffer *needle)
+{
+	__m128i lo, hi, k;
+	if (haystack->size != needle->size)
+		return 0;
+	lo = _mm_loadu_si128((__m128i *) haystack->buf);
+	hi = _mm_loadu_si128((__m128i *) &haystack->buf[8]);
+	for (unsigned int x = 0; x < needle->size; x++) {
+		k = _mm_set1_epi16(needle->buf[x]);
+		if (!_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(lo, k),
+			_mm_cmpeq_epi16(hi, k))))
+			return 0;
+	}
+	return 1;
+}
+
+__attribute__ ((target("avx2")))
+int compare_avx2 (struct key_buffer *haystack, struct key_buffer *needle)
+{
+	__m256i h, k;
+	if (haystack->size != needle->size)
+		return 0;
+	h = _mm256_loadu_si256((__m256i *) haystack->buf);
+	for (unsigned int x = 0; x < needle->size; x++) {
+		k = _mm256_set1_epi16(needle->buf[x]);
+		if (!_mm256_movemask_epi8(_mm256_cmpeq_epi16(h, k)))
+			return 0;
+	}
+	return 1;
+}
+#endif
+
+unsigned long scan (int (*compare)(struct key_buffer *, struct key_buffer *))
+{
+	unsigned long hits = 0;
+	for (int l = 0; l < LOOKUPS; l++)
+		for (int i = 0; i < HOTKEYS; i++)
+			hits += compare(&lookups[l], &hotkeys[i].kb);
+	return hits;
+}
+
+unsigned long probe (void)
+{
+	unsigned long hits = 0;
+	unsigned long long hash;
+	struct hotkey *tmp;
+
+	for (int l = 0; l < LOOKUPS; l++) {
+		hash = 0;
+		for (unsigned int i = 0; i < lookups[l].size; i++)
+			hash ^= key_hash(lookups[l].buf[i]);
+		tmp = chord_table[hash & chord_table_mask];
+		for (; tmp; tmp = tmp->match_next)
+			hits += tmp->hash == hash && compare_scalar(&lookups[l], &tmp->kb);
+	}
+	return hits;
+}
+
+void prepare (void)
+{
+	unsigned long size = 1;
+	struct hotkey **bucket;
+
+	srand(1);
+	for (int i = 0; i < HOTKEYS; i++) {
+		struct key_buffer *kb = &hotkeys[i].kb;
+		kb->size = 2 + rand() % 4;
+		for (unsigned int j = 0; j < kb->size; j++) {
+			unsigned short key;
+			int dup;
+			do {
+				key = 1 + rand() % KEY_MAX_CODE;
+				dup = 0;
+				for (unsigned int x = 0; x < j; x++)
+					dup |= kb->buf[x] == key;
+			} while (dup);
+			kb->buf[j] = key;
+			hotkeys[i].hash ^= key_hash(key);
+		}
+	}
+
+	/* Every lookup is a shuffled hotkey, so that there is at least a hit */
+	for (int l = 0; l < LOOKUPS; l++) {
+		lookups[l] = hotkeys[rand() % HOTKEYS].kb;
+		for (int j = lookups[l].size - 1; j > 0; j--) {
+			int x = rand() % (j + 1);
+			unsigned short t = lookups[l].buf[j];
+			lookups[l].buf[j] = lookups[l].buf[x];
+			lookups[l].buf[x] = t;
+		}
+	}
+
+	while (size < HOTKEYS * 2)
+		size <<= 1;
+	chord_table = calloc(size, sizeof(struct hotkey *));
+	chord_table_mask = size - 1;
+	for (int i = 0; i < HOTKEYS; i++) {
+		bucket = &chord_table[hotkeys[i].hash & chord_table_mask];
+		while (*bucket)
+			bucket = &(*bucket)->match_next;
+		*bucket = &hotkeys[i];
+	}
+}
+
+double now (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void report (const char *name, double start, unsigned long hits)
+{
+	printf("%-8s %10.1f ns/lookup  %lu hits\n", name,
+		(now() - start) / LOOKUPS, hits);
+}
+
+int main (void)
+{
+	double start;
+	unsigned long hits;
+
+	prepare();
+	printf("%d hotkeys, %d lookups\n", HOTKEYS, LOOKUPS);
+
+	start = now();
+	hits = scan(compare_scalar);
+	report("scalar", start, hits);
+#ifdef HAVE_X86
+	start = now();
+	hits = scan(compare_sse2);
+	report("sse2", start, hits);
+	if (__builtin_cpu_supports("avx2")) {
+		start = now();
+		hits = scan(compare_avx2);
+		report("avx2", start, hits);
+	}
+#endif
+	start = now();
+	hits = probe();
+	report("hash", start, hits);
+	return 0;
+}
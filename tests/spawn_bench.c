@@ -0,0 +1,96 @@
+/* Benchmark of the ways hkd can start a command: fork + exec, vfork + exec
+ * and posix_spawn, with the parent holding a growing amount of memory.
+ * "return" is the time the parent is blocked (the event loop can not read
+ * keys meanwhile), "exit" is the time until the child has run and exited.
+ *
+ * gcc -O2 -std=c99 spawn_bench.c -o spawn_bench && ./spawn_bench [command] */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define RUNS 200
+
+extern char **environ;
+
+double now (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+pid_t run_fork (char **argv)
+{
+	pid_t pid = fork();
+	if (!pid) {
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+pid_t run_vfork (char **argv)
+{
+	pid_t pid = vfork();
+	if (!pid) {
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	return pid;
+}
+
+pid_t run_spawn (char **argv)
+{
+	pid_t pid;
+	if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ))
+		return -1;
+	return pid;
+}
+
+void bench (const char *name, pid_t (*run)(char **), char **argv)
+{
+	double start, ret = 0, ext = 0;
+	pid_t pid;
+
+	for (int i = 0; i < RUNS; i++) {
+		start = now();
+		if ((pid = run(argv)) < 0) {
+			perror(name);
+			return;
+		}
+		ret += now() - start;
+		waitpid(pid, NULL, 0);
+		ext += now() - start;
+	}
+	printf("  %-12s return %8.1f us  exit %8.1f us\n", name,
+		ret / RUNS, ext / RUNS);
+}
+
+int main (int argc, char *argv[])
+{
+	char *cmd[] = {argc > 1 ? argv[1] : "true", NULL};
+	const size_t sizes[] = {0, 64, 512};
+
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		/* Touch the memory so that it is really mapped */
+		size_t len = sizes[i] << 20;
+		char *mem = malloc(len + 1);
+		if (!mem)
+			return 1;
+		memset(mem, 1, len + 1);
+
+		printf("RSS + %zu MiB\n", sizes[i]);
+		bench("fork", run_fork, cmd);
+		bench("vfork", run_vfork, cmd);
+		bench("posix_spawn", run_spawn, cmd);
+		free(mem);
+	}
+	return 0;
+}